@@ -2,8 +2,21 @@ platform = K210
 CROSS_COMPILE = riscv64-unknown-elf-
 CFLAGS = -nostdlib -mcmodel=medany -fno-builtin -march=rv64ima -mabi=lp64 -g -Wall -D$(platform)
 
+# 每个任务的CPU时间统计（task_top()），置为0时统计代码被完全去掉
+SCHED_ACCT = 1
+CFLAGS += -DSCHED_ACCT=$(SCHED_ACCT)
+
+# 唤醒到运行的延迟直方图（latency_stat()），置为0时统计代码被完全去掉
+SCHED_LATENCY = 1
+CFLAGS += -DSCHED_LATENCY=$(SCHED_LATENCY)
+
+# 内核跟踪点（trace.h），置为1时各跟踪点向每个hart的环形缓冲区写入记录
+KERNEL_TRACE = 0
+CFLAGS += -DKERNEL_TRACE=$(KERNEL_TRACE)
+
 QEMU = qemu-system-riscv64
-QFLAGS = -nographic -smp 1 -machine virt -bios none
+CPUS = 4
+QFLAGS = -nographic -smp $(CPUS) -machine virt -bios none
 
 GDB = gdb-multiarch
 CC = ${CROSS_COMPILE}gcc
@@ -0,0 +1,102 @@
+/*
+ * 异步提交/完成环（与io_uring类似）
+ *
+ * 任务与内核共享一对环形队列：任务把若干请求写入提交队列（SQ），
+ * 调用一次io_ring_submit()提交整批请求，之后从完成队列（CQ）中取回结果。
+ * 请求由内核的服务任务成批处理（见task_schedule/ioring.c），
+ * 发出请求的任务不必等待每一次UART输出或定时，
+ * 多次请求只需要一次调用与一次任务切换。
+ *
+ * 两个队列都是单生产者单消费者的：
+ * SQ由任务写sq_tail、服务任务写sq_head；CQ由服务任务写cq_tail、任务写cq_head。
+ * 任务先在sqe_tail处填写请求，提交时才发布到sq_tail，服务任务不会读到填写了一半的请求。
+ * 下标是不断增长的计数，取模后得到槽位，队列中的项数为tail - head。
+ * 每个请求恰好产生一个完成项，已提交但尚未被取回的请求不超过entries个，CQ不会溢出。
+ * 取槽位与取结果的函数不访问CSR与外设，用户模式的任务也可以直接调用。
+ */
+
+#ifndef __IORING_H__
+#define __IORING_H__
+
+#include "types.h"
+#include <stddef.h>
+
+/* 请求的操作码，addr/len的含义见各操作 */
+#define IO_NOP      0   /* 空操作，res为0 */
+#define IO_WRITE    1   /* 向串口输出addr处的len个字符，res为输出的字符数 */
+#define IO_TIMEOUT  2   /* 等待addr微秒后完成，res为0，时间向上对齐到时间片边界 */
+#define IO_MALLOC   3   /* 分配len字节，res为地址，失败时为0 */
+#define IO_FREE     4   /* 释放addr，res为0 */
+#define IO_OP_NR    5
+
+/* 提交队列项，user_data原样带回完成项，用于区分请求 */
+struct io_sqe {
+	uint8_t  opcode;
+	uint8_t  pad[3];
+	uint32_t len;
+	uint64_t addr;
+	uint64_t user_data;
+};
+
+/* 完成队列项，res为负数表示失败（操作码无效或地址不可访问时为-1） */
+struct io_cqe {
+	uint64_t user_data;
+	int64_t  res;
+};
+
+/*
+ * 提交/完成环中与任务共享的部分，由io_ring_create()分配，sqes与cqes紧随其后
+ * 内核一侧的状态（锁、等待队列、数组的位置与大小等）保存在内核私有的描述符中，
+ * 见task_schedule/ioring.c；内核只从这里读取sq_tail、cq_head与id，
+ * 任务改写其它字段只会影响它自己
+ * sqe_tail：已经取得的槽位计数，只由任务访问
+ * entries/sqes/cqes：供任务使用的队列大小与数组位置
+ * id：内核描述符的编号
+ */
+struct io_ring {
+	volatile uint32_t sq_head;
+	volatile uint32_t sq_tail;
+	volatile uint32_t cq_head;
+	volatile uint32_t cq_tail;
+	uint32_t sqe_tail;
+	uint32_t entries;
+	uint32_t id;
+	struct io_sqe *sqes;
+	struct io_cqe *cqes;
+};
+
+/*
+ * 取得一个空闲的提交队列槽位，填写后由io_ring_submit()提交
+ * 返回值：
+ * 槽位，已提交但尚未取回结果的请求达到entries个时返回NULL
+ */
+static inline struct io_sqe *io_get_sqe(struct io_ring *ring)
+{
+	uint32_t tail = ring->sqe_tail;
+	if (tail - ring->cq_head >= ring->entries)
+		return NULL;
+	ring->sqe_tail = tail + 1;
+	return &ring->sqes[tail & (ring->entries - 1)];
+}
+
+/*
+ * 取得最早的完成项，处理完后调用io_cqe_seen()
+ * 返回值：
+ * 完成项，完成队列为空时返回NULL
+ */
+static inline struct io_cqe *io_peek_cqe(struct io_ring *ring)
+{
+	uint32_t head = ring->cq_head;
+	if (head == ring->cq_tail)
+		return NULL;
+	__sync_synchronize();
+	return &ring->cqes[head & (ring->entries - 1)];
+}
+
+static inline void io_cqe_seen(struct io_ring *ring)
+{
+	__sync_synchronize();
+	ring->cq_head++;
+}
+
+#endif /* __IORING_H__ */
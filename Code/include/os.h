@@ -9,6 +9,12 @@
 #include "../platform/qemu_virt.h"
 #include "../platform/K210.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "sync.h"
+#include "ioring.h"
+#include "pt.h"
+#include "trace.h"
+#include "syscall.h"
 
 /*
  * stddef.h 头文件定义了各种变量类型和宏，如size_t,NULL等
@@ -27,30 +33,147 @@ extern void uarths_init(void);
 extern int k210_uart_init();
 extern int uart_putc(char ch);
 extern void uart_puts(char *s);
+extern reg_t uart_lock(void);
+extern void uart_unlock(reg_t flags);
+#define UART_EV_RX (1 << 0)
+extern struct event_group uart_events;
 
 /* printf */
 extern int printf(const char* s, ...);
 extern void panic(char *s);
 
+/* 内核跟踪，见trace.h */
+extern void trace_init(void);
+extern void trace_start(void);
+extern void trace_stop(void);
+extern void trace_dump(void);
+
 /* page级内存管理方法 */
 extern void page_init(void);
 extern void page_test(void);
 extern void *page_alloc(int npages);
 extern void page_free(void *p);
 
+/* 堆内存管理，见mem_management/malloc.c */
+extern void malloc_init(void);
+extern void malloc_test(void);
+extern void *malloc(size_t size);
+extern void free(void *ptr);
+
 
-/* 协作式任务调度 */
-extern int  task_create(void (*task)(void* param),void* param,uint8_t priority);
-extern void task_delay(volatile int count);
+/* 协作式任务调度，struct Task作为不透明的任务句柄使用 */
+struct Task;
+extern struct Task *task_create(void (*task)(void* param),void* param,uint8_t priority,uint32_t stack_size);
+extern int  task_yield_to(struct Task *task);
+extern struct Task *task_create_edf(void (*task)(void* param),void* param,
+                                    uint64_t period_us,uint64_t budget_us,uint64_t deadline_us);
+extern int  task_wait_next_period(void);
+extern struct Task *task_create_fair(void (*task)(void* param),void* param,int nice);
+extern struct Task *task_create_user(void (*task)(void* param),void* param,uint8_t priority,uint32_t stack_size);
+extern reg_t task_fault_exit(void);
+extern void syscall_bench(void);
+extern void user_pmp_init(void);
+extern int  user_access_ok(reg_t addr, reg_t len, int write);
+
+/* 任务组CPU配额 */
+struct task_group;
+extern struct task_group *task_group_create(uint64_t quota_us, uint64_t period_us);
+extern void task_group_attach(struct task_group *g, struct Task *task);
+extern void task_group_refill(uint64_t now);
+extern uint64_t task_group_next_refill(void);
+extern void task_group_stat(struct task_group *g);
+extern void task_sleep(uint64_t ticks);
+extern void task_sleep_us(uint64_t us);
 extern void task_yield();
 extern void task_exit();
 
+/* 同步原语，见sync.h */
+extern void mutex_init(struct mutex *m);
+extern int  mutex_lock(struct mutex *m);
+extern int  mutex_trylock(struct mutex *m);
+extern int  mutex_unlock(struct mutex *m);
+extern void sem_init(struct semaphore *s, int count, uint8_t order);
+extern void sem_wait(struct semaphore *s);
+extern int  sem_trywait(struct semaphore *s);
+extern void sem_post(struct semaphore *s);
+extern void cond_init(struct condvar *cv, uint8_t order);
+extern void cond_wait(struct condvar *cv, struct mutex *m);
+extern void cond_signal(struct condvar *cv);
+extern void cond_broadcast(struct condvar *cv);
+extern struct io_ring *io_ring_create(uint32_t entries);
+extern struct io_ring *io_ring_create_user(uint32_t entries);
+extern int  io_ring_delete(struct io_ring *r);
+extern int  io_ring_submit(struct io_ring *r);
+extern int  io_ring_wait(struct io_ring *r, uint32_t min_complete, uint64_t timeout);
+extern struct pt_executor *pt_executor_create(uint8_t priority, uint32_t stack_size);
+extern void pt_spawn(struct pt_executor *ex, struct pt *pt, int (*fn)(struct pt *pt));
+extern int  pt_wake(struct pt *pt);
+extern void event_init(struct event_group *eg);
+extern uint32_t event_set(struct event_group *eg, uint32_t bits);
+extern uint32_t event_clear(struct event_group *eg, uint32_t bits);
+extern uint32_t event_get(struct event_group *eg);
+extern int  event_wait(struct event_group *eg, uint32_t mask, int options,
+                       uint64_t timeout, uint32_t *flags);
+extern int  task_notify(struct Task *task, uint32_t value, int action);
+extern void task_notify_give(struct Task *task);
+extern uint32_t notify_take(int clear, uint64_t timeout);
+extern int  notify_wait(uint32_t clear_on_entry, uint32_t clear_on_exit,
+                        uint32_t *value, uint64_t timeout);
+extern struct msgqueue *mq_create(int capacity);
+extern int  mq_delete(struct msgqueue *mq);
+extern int  mq_send(struct msgqueue *mq, void *msg, uint64_t timeout);
+extern int  mq_recv(struct msgqueue *mq, void **msg, uint64_t timeout);
+
+/* 抢占式时间片调度 */
+extern reg_t schedule_tick(reg_t epc);
+extern void sched_irq_exit(void);
+extern void sched_stat(void);
+extern void task_top(void);
+extern void latency_stat(void);
+extern void stack_stat(void);
+
+/* 看门狗：任务连续占用CPU超时时的处理方式，见watchdog.c */
+#define WD_REPORT  0
+#define WD_RESCHED 1
+#define WD_KILL    2
+extern void watchdog_set(uint64_t limit_us, int action);
+extern void watchdog_stat(void);
+extern void latency_reset(void);
+extern void switch_bench(void);
+extern void sched_bench(void);
+extern void pt_bench(int n);
+extern void notify_bench(void);
+
 extern void os_main(void);
 extern void sched_init(void);
+extern void sched_hart_init(void);
+extern void sched_start(void);
+extern void sched_kick(int hart);
 
 /* 异常处理相关 */
 extern void interrupt_vector_init();
 extern reg_t trap_handler(reg_t epc, reg_t cause);
 extern void trap_test();
+extern reg_t Machine_external_handler(reg_t epc, reg_t cause);
+extern reg_t Machine_timer_handler(reg_t epc, reg_t cause);
+extern reg_t Machine_software_handler(reg_t epc, reg_t cause);
+
+/* 定时器 */
+extern void timer_init(void);
+extern void timer_load(uint64_t interval);
+extern void timer_load_tick(uint64_t ticks);
+extern void timer_idle(uint64_t deadline);
+extern void timer_idle_exit(void);
+extern void timer_tick(void);
+extern void timer_set_quantum(uint64_t quantum);
+extern uint64_t timer_get_tick(void);
+extern uint64_t timer_get_quantum(void);
+extern uint64_t timer_get_mtime(void);
+extern uint64_t timer_us_to_tick(uint64_t us);
+extern uint64_t timer_us_to_cycles(uint64_t us);
+extern uint64_t timer_cycles_to_us(uint64_t cycles);
+extern uint64_t timer_mtime_to_tick(uint64_t mtime);
+extern void timer_wheel_expire(uint64_t now);
+extern uint64_t timer_wheel_next(void);
 
 #endif /* __OS_H__ */
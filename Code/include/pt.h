@@ -0,0 +1,71 @@
+/*
+ * 无栈的轻量任务（protothread）
+ *
+ * 轻量任务是一个返回状态码的普通函数，执行到等待点时把续点（行号）保存在lc中并返回，
+ * 下次被调用时从switch跳转到该续点继续执行，不需要自己的栈与寄存器上下文。
+ * 同一个执行器（pt_executor）中的所有轻量任务轮流运行在执行器任务的栈上，
+ * 执行器是普通的任务，照常参与cooperative.c的调度。
+ * 每个轻量任务只占用一个32字节的struct pt，上万个轻量任务只需要几百KiB。
+ *
+ * 限制：
+ * 局部变量在等待点之间不会保留，需要保留的状态放在包含struct pt的结构体中；
+ * 等待点不能位于switch语句中；不能在轻量任务中调用会阻塞的函数，
+ * 否则同一执行器中的其它轻量任务也无法运行。
+ */
+
+#ifndef __PT_H__
+#define __PT_H__
+
+#include "types.h"
+
+/* 轻量任务例程的返回值，由下面的宏产生 */
+#define PT_YIELDED  0   /* 让出执行器，排到就绪队列队尾 */
+#define PT_WAITING  1   /* 等待pt_wake() */
+#define PT_SLEEPING 2   /* 睡眠wake个时间片 */
+#define PT_EXITED   3   /* 结束 */
+
+struct pt_executor;
+
+/*
+ * 轻量任务，通常嵌入使用者自己的结构体中
+ * next：所在的就绪队列或睡眠槽中的下一个轻量任务
+ * fn：例程，参数为轻量任务自身
+ * ex：所属的执行器
+ * wake：睡眠时为到期的时间片计数（低32位），PT_SLEEP()中暂存睡眠的时间片数
+ * lc：续点，0表示从头开始
+ * state：见task_schedule/protothread.c，由执行器的锁保护
+ */
+struct pt {
+	struct pt *next;
+	int (*fn)(struct pt *pt);
+	struct pt_executor *ex;
+	uint32_t wake;
+	uint16_t lc;
+	uint8_t state;
+	uint8_t flags;
+};
+
+#define PT_BEGIN(pt)    switch ((pt)->lc) { case 0:
+
+/* 例程结束，执行器之后不再访问pt，例程可以在此之前释放它 */
+#define PT_END(pt)      } return PT_EXITED
+
+#define PT_EXIT(pt)     return PT_EXITED
+
+#define PT_YIELD(pt) \
+	do { (pt)->lc = __LINE__; return PT_YIELDED; case __LINE__:; } while (0)
+
+/* 条件不满足时让出执行器，下次轮到时重新检查 */
+#define PT_WAIT_UNTIL(pt, cond) \
+	do { (pt)->lc = __LINE__; case __LINE__: if (!(cond)) return PT_YIELDED; } while (0)
+
+/* 等待其它任务、轻量任务或中断处理函数调用pt_wake()，之前已有未被消耗的唤醒时立即返回 */
+#define PT_WAIT(pt) \
+	do { (pt)->lc = __LINE__; return PT_WAITING; case __LINE__:; } while (0)
+
+/* 睡眠ticks个时间片（至少1个） */
+#define PT_SLEEP(pt, ticks) \
+	do { (pt)->wake = (uint32_t)(ticks); (pt)->lc = __LINE__; return PT_SLEEPING; \
+	     case __LINE__:; } while (0)
+
+#endif /* __PT_H__ */
@@ -15,6 +15,12 @@ static inline reg_t r_tp(){
     return x;
 }
 
+static inline reg_t r_sp(){
+    reg_t x;
+    asm volatile("mv %0, sp" : "=r" (x) );
+    return x;
+}
+
 /* 读取当前Hart编号 */
 static inline reg_t r_mhartid()
 {
@@ -47,6 +53,23 @@ static inline void w_mstatus(reg_t x)
 	asm volatile("csrw mstatus, %0" : : "r" (x));
 }
 
+/*
+ * 关闭全局中断，返回关闭前的mstatus
+ * 与irq_restore()配对使用，保护与中断处理函数共享的数据
+ */
+static inline reg_t irq_save()
+{
+	reg_t x;
+	asm volatile("csrrci %0, mstatus, %1" : "=r" (x) : "i" (MSTATUS_MIE) : "memory");
+	return x;
+}
+
+/* 恢复irq_save()之前的全局中断状态 */
+static inline void irq_restore(reg_t x)
+{
+	asm volatile("csrs mstatus, %0" : : "r" (x & MSTATUS_MIE) : "memory");
+}
+
 /*
  * 机器异常程序计数器，保存异常返回的指令地址。
  */
@@ -68,6 +91,13 @@ static inline void w_mscratch(reg_t x)
 	asm volatile("csrw mscratch, %0" : : "r" (x));
 }
 
+static inline reg_t r_mscratch()
+{
+	reg_t x;
+	asm volatile("csrr %0, mscratch" : "=r" (x));
+	return x;
+}
+
 /* Machine-mode interrupt vector */
 static inline void w_mtvec(reg_t x)
 {
@@ -91,6 +121,21 @@ static inline void w_mie(reg_t x)
 	asm volatile("csrw mie, %0" : : "r" (x));
 }
 
+/* 机器模式周期计数器与指令计数器 */
+static inline reg_t r_mcycle()
+{
+	reg_t x;
+	asm volatile("csrr %0, mcycle" : "=r" (x) );
+	return x;
+}
+
+static inline reg_t r_minstret()
+{
+	reg_t x;
+	asm volatile("csrr %0, minstret" : "=r" (x) );
+	return x;
+}
+
 static inline reg_t r_mcause()
 {
 	reg_t x;
@@ -98,5 +143,63 @@ static inline reg_t r_mcause()
 	return x;
 }
 
+/*
+ * 物理内存保护（PMP），特权级规范1.10及以上
+ * 每个表项的配置占pmpcfg中的8位：R/W/X权限、地址匹配模式A与锁定位L
+ * 未锁定的表项只约束S/U模式的访问
+ * K210实现的是1.9.1规范，没有这些CSR
+ */
+#define PMP_R       (1 << 0)
+#define PMP_W       (1 << 1)
+#define PMP_X       (1 << 2)
+#define PMP_A_TOR   (1 << 3)
+#define PMP_A_NAPOT (3 << 3)
+#define PMP_L       (1 << 7)
+
+/* 大小为size（2的幂，至少8字节）、按size对齐的NAPOT区域对应的pmpaddr */
+#define PMP_NAPOT_ADDR(base, size) (((reg_t)(base) | ((size) / 2 - 1)) >> 2)
+
+static inline reg_t r_pmpcfg0()
+{
+	reg_t x;
+	asm volatile("csrr %0, pmpcfg0" : "=r" (x) );
+	return x;
+}
+
+static inline void w_pmpcfg0(reg_t x)
+{
+	asm volatile("csrw pmpcfg0, %0" : : "r" (x));
+}
+
+static inline void w_pmpaddr0(reg_t x)
+{
+	asm volatile("csrw pmpaddr0, %0" : : "r" (x));
+}
+
+static inline void w_pmpaddr1(reg_t x)
+{
+	asm volatile("csrw pmpaddr1, %0" : : "r" (x));
+}
+
+static inline void w_pmpaddr2(reg_t x)
+{
+	asm volatile("csrw pmpaddr2, %0" : : "r" (x));
+}
+
+static inline void w_pmpaddr3(reg_t x)
+{
+	asm volatile("csrw pmpaddr3, %0" : : "r" (x));
+}
+
+static inline void w_pmpaddr4(reg_t x)
+{
+	asm volatile("csrw pmpaddr4, %0" : : "r" (x));
+}
+
+static inline void w_pmpaddr5(reg_t x)
+{
+	asm volatile("csrw pmpaddr5, %0" : : "r" (x));
+}
+
 
 #endif /* __RISCV_H__ */
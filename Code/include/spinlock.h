@@ -0,0 +1,46 @@
+/*
+ * 定义自旋锁，用于多个hart之间的互斥
+ */
+
+#ifndef __SPINLOCK_H__
+#define __SPINLOCK_H__
+
+#include "types.h"
+#include "riscv.h"
+
+/*
+ * ref: https://github.com/mit-pdos/xv6-riscv/blob/riscv/kernel/spinlock.c
+ * locked：为 1 表示锁已被占用
+ */
+struct spinlock {
+	volatile uint32_t locked;
+};
+
+static inline void spin_init(struct spinlock *lk)
+{
+	lk->locked = 0;
+}
+
+/*
+ * 获取自旋锁
+ * __sync_lock_test_and_set 在RISC-V上编译为 amoswap.w.aq
+ * 注意：自旋锁不会关闭中断，若锁同时被中断处理函数使用，
+ * 调用者需要先调用irq_save()关闭本hart的中断
+ */
+static inline void spin_lock(struct spinlock *lk)
+{
+	while (__sync_lock_test_and_set(&lk->locked, 1) != 0)
+		;
+	/* 保证临界区内的访存不会被提前到获取锁之前 */
+	__sync_synchronize();
+}
+
+/* 释放自旋锁 */
+static inline void spin_unlock(struct spinlock *lk)
+{
+	/* 保证临界区内的访存在释放锁之前完成 */
+	__sync_synchronize();
+	__sync_lock_release(&lk->locked);
+}
+
+#endif /* __SPINLOCK_H__ */
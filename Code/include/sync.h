@@ -0,0 +1,136 @@
+/*
+ * 定义任务间的同步原语：等待队列、互斥锁、信号量、条件变量、消息队列与事件组
+ * 实现见task_schedule/sync.c、task_schedule/msgqueue.c与task_schedule/event.c
+ */
+
+#ifndef __SYNC_H__
+#define __SYNC_H__
+
+#include "types.h"
+#include "spinlock.h"
+
+struct Task;
+
+/*
+ * 等待队列的排序方式
+ * WQ_FIFO：按照等待的先后顺序唤醒
+ * WQ_PRIO：优先唤醒优先级最高的任务，同优先级按照先后顺序
+ */
+#define WQ_FIFO 0
+#define WQ_PRIO 1
+
+/*
+ * 等待超时，单位为时间片
+ * WAIT_FOREVER：一直等待，直到被唤醒
+ * 0：不等待，条件不满足时立即返回
+ */
+#define WAIT_FOREVER ((uint64_t)-1)
+
+/*
+ * 等待队列，由Task的wait_next组成的单向链表
+ * 等待的任务不在任何就绪队列中，直到被唤醒
+ * 等待队列由其所属对象的锁保护
+ */
+struct wait_queue {
+	struct Task *head;
+	uint8_t order;
+};
+
+/*
+ * 互斥锁，不可重入，只能由持有者释放
+ * 等待队列按优先级排序，并支持优先级继承：
+ * 高优先级任务等待时，持有者的优先级被临时提升到与之相同
+ * owner：持有者，为NULL表示未被持有
+ * held_next：持有者所持有的互斥锁组成的链表
+ */
+struct mutex {
+	struct spinlock lock;
+	struct Task *owner;
+	struct wait_queue wq;
+	struct mutex *held_next;
+};
+
+/* 计数信号量，可以在中断处理函数中调用sem_post() */
+struct semaphore {
+	struct spinlock lock;
+	int count;
+	struct wait_queue wq;
+};
+
+/* 条件变量，与互斥锁配合使用 */
+struct condvar {
+	struct spinlock lock;
+	struct wait_queue wq;
+};
+
+/*
+ * 消息队列，消息是一个指针：发送者把缓冲区的所有权交给接收者，数据本身不拷贝
+ * slots是创建时一次性分配的环形缓冲区，head指向最早的消息，count为消息数
+ * 接收者等待时，发送的消息直接交给队首的接收者，不经过环形缓冲区；
+ * 缓冲区满时，发送者在send_wq上等待，接收时把它的消息补入缓冲区
+ */
+struct msgqueue {
+	struct spinlock lock;
+	int capacity;
+	int head;
+	int count;
+	struct wait_queue send_wq;
+	struct wait_queue recv_wq;
+	void *slots[];
+};
+
+/*
+ * task_notify()的操作
+ * NOTIFY_NONE：只发出通知，不修改通知值
+ * NOTIFY_INCREMENT：通知值加1，与notify_take()配合作为轻量的计数信号量
+ * NOTIFY_SET_BITS：通知值与value按位或，作为轻量的事件标志
+ * NOTIFY_OVERWRITE：通知值改为value
+ * NOTIFY_NO_OVERWRITE：上一个通知尚未被取走时失败，否则通知值改为value，作为长度为1的邮箱
+ */
+#define NOTIFY_NONE         0
+#define NOTIFY_INCREMENT    1
+#define NOTIFY_SET_BITS     2
+#define NOTIFY_OVERWRITE    3
+#define NOTIFY_NO_OVERWRITE 4
+
+/*
+ * event_wait()的选项
+ * EV_ANY：mask中的任意一位被置位即满足
+ * EV_ALL：mask中的所有位都被置位才满足
+ * EV_CLEAR：满足时清除mask中的位，可与EV_ANY或EV_ALL组合
+ */
+#define EV_ANY   0
+#define EV_ALL   1
+#define EV_CLEAR 2
+
+/* 每个事件组中按等待条件分类的等待队列数 */
+#define EV_CLASSES 4
+
+/*
+ * 等待条件相同（mask与EV_ALL都相同）的等待者组成的一类，
+ * 同一类的等待者的条件总是同时满足，等待队列为空时这一类可以被其它条件复用
+ */
+struct event_class {
+	uint32_t mask;
+	int all;
+	struct wait_queue wq;
+};
+
+/*
+ * 事件组，32个事件标志位，可以在中断处理函数中调用event_set()
+ * flags：当前的标志位
+ * wait_bits：等待的任务关心的位的并集，置位的标志与它无交集时不检查任何等待者
+ * cls：按等待条件分类的等待者，置位时只访问条件已经满足的类中的任务
+ * wq/misc_bits：等待条件的种类超过EV_CLASSES时其余的等待者及其关心的位的并集，
+ *   置位的标志与misc_bits有交集时逐个检查
+ */
+struct event_group {
+	struct spinlock lock;
+	uint32_t flags;
+	uint32_t wait_bits;
+	uint32_t misc_bits;
+	struct event_class cls[EV_CLASSES];
+	struct wait_queue wq;
+};
+
+#endif /* __SYNC_H__ */
@@ -0,0 +1,60 @@
+/*
+ * 系统调用
+ *
+ * 用户模式的任务通过ecall进入内核，a7为系统调用号，a0-a5为参数，返回值在a0中。
+ * 系统调用按照普通函数调用的约定进行：ra、t0-t6、a0-a7可能被破坏，
+ * 因此内核的入口（entry.S的syscall_entry）不需要保存完整的上下文
+ */
+
+#ifndef __SYSCALL_H__
+#define __SYSCALL_H__
+
+#include "types.h"
+
+/* 系统调用号，处理函数见interrupt_and_trap/syscall.c */
+#define SYS_null      0   /* 空调用，用于测试往返开销 */
+#define SYS_write     1   /* (buf, len)：向串口输出len个字符 */
+#define SYS_yield     2
+#define SYS_sleep_us  3   /* (us) */
+#define SYS_exit      4
+#define SYS_cycles    5   /* 返回mcycle */
+#define SYS_mtime     6   /* 返回mtime */
+#define SYS_malloc    7   /* (size) */
+#define SYS_free      8   /* (ptr) */
+#define SYS_io_setup  9   /* (entries)：创建提交/完成环，见ioring.h */
+#define SYS_io_submit 10  /* (ring) */
+#define SYS_io_wait   11  /* (ring, min_complete, timeout) */
+#define SYS_NR        12
+
+/*
+ * 用户模式的系统调用存根
+ * 除了参数与返回值之外，还需要把其余调用者保存的寄存器声明为被破坏
+ */
+static inline reg_t syscall3(reg_t nr, reg_t arg0, reg_t arg1, reg_t arg2)
+{
+	register reg_t a0 asm("a0") = arg0;
+	register reg_t a1 asm("a1") = arg1;
+	register reg_t a2 asm("a2") = arg2;
+	register reg_t a7 asm("a7") = nr;
+	asm volatile("ecall"
+		     : "+r" (a0), "+r" (a1), "+r" (a2)
+		     : "r" (a7)
+		     : "ra", "t0", "t1", "t2", "t3", "t4", "t5", "t6",
+		       "a3", "a4", "a5", "a6", "memory");
+	return a0;
+}
+
+static inline reg_t syscall0(reg_t nr)
+{
+	return syscall3(nr, 0, 0, 0);
+}
+
+static inline reg_t syscall1(reg_t nr, reg_t arg0)
+{
+	return syscall3(nr, arg0, 0, 0);
+}
+
+/* 用户模式任务的例程返回时进入这里，通过SYS_exit退出 */
+extern void usys_exit(void);
+
+#endif /* __SYSCALL_H__ */
@@ -0,0 +1,88 @@
+/*
+ * 内核静态跟踪点
+ *
+ * 每个跟踪点向本hart的环形缓冲区写入一条带mtime时间戳的定长二进制记录，
+ * 不做格式化，也不访问UART，开销只有几次访存。
+ * 缓冲区写满后覆盖最旧的记录。
+ * 缓冲区可以通过trace_dump()从UART输出，也可以从QEMU的内存转储中提取，
+ * 由tools/trace2perfetto.py转换为Chrome/Perfetto可以打开的JSON。
+ * KERNEL_TRACE为0时TRACE()展开为空，跟踪点不产生任何代码
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "types.h"
+
+/* 由common.mk中的KERNEL_TRACE控制 */
+#ifndef KERNEL_TRACE
+#define KERNEL_TRACE 0
+#endif
+
+/* 事件类型，arg0/arg1的含义见各事件 */
+#define TRACE_SWITCH        1   /* 任务切换，arg0：切出任务的tid，arg1：切入任务的tid */
+#define TRACE_TRAP_ENTER    2   /* 进入trap，arg0：mcause，arg1：mepc */
+#define TRACE_TRAP_EXIT     3   /* 退出trap，arg1：返回地址 */
+#define TRACE_IRQ_CLAIM     4   /* 从PLIC领取外部中断，arg0：中断号 */
+#define TRACE_IRQ_COMPLETE  5   /* 外部中断处理完成，arg0：中断号 */
+#define TRACE_MALLOC        6   /* arg0：请求的大小，arg1：返回的地址 */
+#define TRACE_FREE          7   /* arg1：释放的地址 */
+#define TRACE_PAGE_ALLOC    8   /* arg0：页数，arg1：返回的地址 */
+#define TRACE_PAGE_FREE     9   /* arg1：释放的地址 */
+
+/* 缓冲区头部的魔数，主机工具据此在内存转储中定位缓冲区 */
+#define TRACE_MAGIC 0x52545652  /* "RVTR" */
+
+/* 每个hart的记录数，必须是2的幂 */
+#define TRACE_BUF_SIZE 1024
+
+/* 一条跟踪记录，24字节 */
+struct trace_rec {
+	uint64_t ts;        /* mtime */
+	uint32_t event;
+	uint32_t arg0;
+	uint64_t arg1;
+};
+
+/*
+ * 每个hart的环形缓冲区
+ * 头部字段的布局是主机工具的约定，修改时需同步修改tools/trace2perfetto.py
+ * head：写入过的记录总数，最新的记录位于rec[(head - 1) % TRACE_BUF_SIZE]
+ */
+struct trace_buf {
+	uint32_t magic;
+	uint32_t hart;
+	uint32_t size;
+	uint32_t rec_size;
+	uint64_t timebase;
+	uint64_t head;
+	struct trace_rec rec[TRACE_BUF_SIZE];
+};
+
+#if KERNEL_TRACE
+extern struct trace_buf trace_bufs[];
+extern volatile int trace_on;
+
+/* 写入一条记录，可以在中断处理函数中调用 */
+static inline void trace_record(uint32_t event, uint32_t arg0, uint64_t arg1)
+{
+	if (!trace_on)
+		return;
+	reg_t flags = irq_save();
+	struct trace_buf *buf = &trace_bufs[r_tp()];
+	struct trace_rec *rec = &buf->rec[buf->head & (TRACE_BUF_SIZE - 1)];
+	rec->ts = *(volatile uint64_t*)CLINT_MTIME;
+	rec->event = event;
+	rec->arg0 = arg0;
+	rec->arg1 = arg1;
+	buf->head++;
+	irq_restore(flags);
+}
+
+#define TRACE(event, arg0, arg1) \
+	trace_record((event), (uint32_t)(arg0), (uint64_t)(arg1))
+#else
+#define TRACE(event, arg0, arg1) do { } while (0)
+#endif
+
+#endif /* __TRACE_H__ */
@@ -3,17 +3,12 @@
 extern void trap_vector(void);
 volatile plic_t *const plic = (volatile plic_t *)PLIC_BASE;
 
-void interrupt_vector_init(){
-    /*
-     * 设置机器模式的interrupt-vector基址，
-     * 同时设置中断向量模式
-     */
-    
-    
-    int hart=r_tp();
+/*
+ * 初始化PLIC，将UART中断交给hart处理
+ * - hart：处理外部中断的hart
+ */
+static void plic_init(int hart){
 #ifdef K210
-    w_mtvec((reg_t)trap_vector);
-
     plic->source_priorities.priority[UARTHS_IRQ] = 1;
 
     /* Get current enable bit array by IRQ number */
@@ -32,9 +27,6 @@ void interrupt_vector_init(){
 
     plic->targets.target[hart].priority_threshold = 0;
 #else
-    reg_t mtvec_vector_table= (reg_t)&__mtvec_vector_table;
-    mtvec_vector_table |= VECTOR_MODE; 
-    w_mtvec(mtvec_vector_table);
     /*
      * 设定UART0的优先级 
      * 
@@ -61,8 +53,32 @@ void interrupt_vector_init(){
      */
     *(uint32_t*)PLIC_MTHRESHOLD(hart) = 0;
 #endif
-    /* enable machine-mode external interrupts. */
-	w_mie(r_mie() | MIE_MEIE);
+}
+
+void interrupt_vector_init(){
+    /*
+     * 设置机器模式的interrupt-vector基址，
+     * 同时设置中断向量模式
+     */
+    int hart=r_tp();
+#ifdef K210
+    w_mtvec((reg_t)trap_vector);
+#else
+    reg_t mtvec_vector_table= (reg_t)&__mtvec_vector_table;
+    mtvec_vector_table |= VECTOR_MODE; 
+    w_mtvec(mtvec_vector_table);
+#endif
+
+    /* 外部中断（UART）只交给hart 0处理，其它hart只需设置trap向量 */
+    if(hart == 0){
+        plic_init(hart);
+
+        /* enable machine-mode external interrupts. */
+        w_mie(r_mie() | MIE_MEIE);
+    }
+
+    /* 核间中断用于唤醒空闲的hart，见sched_kick() */
+    w_mie(r_mie() | MIE_MSIE);
 
     /* enable machine-mode global interrupts. */
 	w_mstatus(r_mstatus() | MSTATUS_MIE);
@@ -99,8 +115,32 @@ void default_vector_handler(){
     //留作备用
 }
 
-void Machine_timer_handler(){
-    //暂未实现
+/*
+ * 机器模式定时器中断处理函数
+ * 每次中断代表一个时间片到期：装载下一个时间片，
+ * 然后交给调度器决定是否抢占当前任务。
+ * 若发生抢占，schedule_tick()会修改mscratch，
+ * 中断返回时将恢复新任务的上下文。
+ * 看门狗终止任务时，schedule_tick()返回新的返回地址。
+ */
+reg_t Machine_timer_handler(reg_t epc, reg_t cause){
+    reg_t return_pc = epc;
+
+    timer_tick();
+    return_pc = schedule_tick(epc);
+
+    return return_pc;
+}
+
+/*
+ * 机器模式软件中断（核间中断）处理函数
+ * 其它hart通过sched_kick()写本hart的MSIP唤醒处于wfi的空闲任务，
+ * 或者在唤醒了应当抢占本hart当前任务的任务时请求重新调度，
+ * 这里只需清除MSIP，空闲任务返回后会重新调度，抢占由trap返回路径完成
+ */
+reg_t Machine_software_handler(reg_t epc, reg_t cause){
+    *(volatile uint32_t*)CLINT_MSIP(r_tp()) = 0;
+    return epc;
 }
 
 reg_t Machine_external_handler(reg_t epc, reg_t cause){
@@ -108,6 +148,9 @@ reg_t Machine_external_handler(reg_t epc, reg_t cause){
 	reg_t cause_code = cause & 0xfff;
 
     int irq = plic_claim();
+    if(irq){
+        TRACE(TRACE_IRQ_CLAIM, irq, 0);
+    }
 #ifdef K210
     if(irq == UARTHS_IRQ){
         uart_isr();
@@ -125,6 +168,7 @@ reg_t Machine_external_handler(reg_t epc, reg_t cause){
 #endif
     /* 防止irq为0时也进行完成操作 */
     if(irq){
+        TRACE(TRACE_IRQ_COMPLETE, irq, 0);
         plic_complete(irq);
     }
 
@@ -0,0 +1,205 @@
+#include "../include/os.h"
+
+/*
+ * 系统调用表
+ * 由entry.S的syscall_entry在机器模式下调用，调用时中断已经打开，
+ * 处理函数可以阻塞（让出CPU），返回值通过a0返回给用户模式的任务
+ */
+
+/*
+ * 下列全局变量定义在mem.S中
+ */
+extern reg_t TEXT_START;
+extern reg_t TEXT_END;
+extern reg_t RODATA_END;
+extern reg_t HEAP_START;
+extern reg_t HEAP_SIZE;
+
+/*
+ * 设置本hart上用户模式的任务可以访问的内存，在每个hart初始化时调用
+ * 表项0为正在运行的任务的栈保护区（见cooperative.c的stack_guard_load()），其余表项为：
+ * 1-2：代码段，可读可执行（表项1只作为TOR区域的下界）
+ * 3：只读数据段，只读
+ * 4-5：堆，可读可写，用户模式任务的栈与它申请的内存都在堆中
+ * 内核的.data/.bss、机器模式的栈以及外设都不可访问
+ */
+void user_pmp_init(void){
+#ifdef QEMU
+    w_pmpaddr1(TEXT_START >> 2);
+    w_pmpaddr2(TEXT_END >> 2);
+    w_pmpaddr3(RODATA_END >> 2);
+    w_pmpaddr4(HEAP_START >> 2);
+    w_pmpaddr5((HEAP_START + HEAP_SIZE) >> 2);
+    reg_t cfg = PMP_A_NAPOT
+              | ((reg_t)(PMP_R | PMP_X | PMP_A_TOR) << 16)
+              | ((reg_t)(PMP_R | PMP_A_TOR) << 24)
+              | ((reg_t)(PMP_R | PMP_W | PMP_A_TOR) << 40);
+    w_pmpcfg0((r_pmpcfg0() & ~(reg_t)0xffffffffffff) | cfg);
+#endif
+}
+
+/*
+ * 检查用户模式的任务传入的缓冲区[addr, addr + len)是否完全位于它可以访问的内存中
+ * - write：为1时只允许堆，为0时还允许代码段与只读数据段
+ * 返回值：
+ * 1：可以访问
+ * 0：不可访问
+ */
+int user_access_ok(reg_t addr, reg_t len, int write){
+    if(addr >= HEAP_START && addr - HEAP_START <= HEAP_SIZE
+       && len <= HEAP_START + HEAP_SIZE - addr){
+        return 1;
+    }
+    if(!write && addr >= TEXT_START && addr - TEXT_START <= RODATA_END - TEXT_START
+       && len <= RODATA_END - addr){
+        return 1;
+    }
+    return 0;
+}
+
+typedef reg_t (*syscall_t)(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5);
+
+static reg_t sys_null(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    return 0;
+}
+
+static reg_t sys_write(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    const char *buf = (const char *)a0;
+    if(!user_access_ok(a0, a1, 0)){
+        return -1;
+    }
+    for(reg_t i = 0;i < a1;i++){
+        uart_putc(buf[i]);
+    }
+    return a1;
+}
+
+static reg_t sys_yield(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    task_yield();
+    return 0;
+}
+
+static reg_t sys_sleep_us(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    task_sleep_us(a0);
+    return 0;
+}
+
+static reg_t sys_exit(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    task_exit();
+    return 0;
+}
+
+static reg_t sys_cycles(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    return r_mcycle();
+}
+
+static reg_t sys_mtime(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    return timer_get_mtime();
+}
+
+static reg_t sys_malloc(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    return (reg_t)malloc(a0);
+}
+
+static reg_t sys_free(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    if(a0 != 0 && !user_access_ok(a0, 0, 1)){
+        return -1;
+    }
+    free((void *)a0);
+    return 0;
+}
+
+static reg_t sys_io_setup(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    return (reg_t)io_ring_create_user(a0);
+}
+
+static reg_t sys_io_submit(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    if(!user_access_ok(a0, sizeof(struct io_ring), 1)){
+        return -1;
+    }
+    return io_ring_submit((struct io_ring *)a0);
+}
+
+static reg_t sys_io_wait(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5){
+    if(!user_access_ok(a0, sizeof(struct io_ring), 1)){
+        return -1;
+    }
+    return io_ring_wait((struct io_ring *)a0, a1, a2);
+}
+
+static const syscall_t syscall_table[SYS_NR] = {
+    [SYS_null]     = sys_null,
+    [SYS_write]    = sys_write,
+    [SYS_yield]    = sys_yield,
+    [SYS_sleep_us] = sys_sleep_us,
+    [SYS_exit]     = sys_exit,
+    [SYS_cycles]   = sys_cycles,
+    [SYS_mtime]    = sys_mtime,
+    [SYS_malloc]   = sys_malloc,
+    [SYS_free]     = sys_free,
+    [SYS_io_setup]  = sys_io_setup,
+    [SYS_io_submit] = sys_io_submit,
+    [SYS_io_wait]   = sys_io_wait,
+};
+
+/*
+ * 按系统调用号分发
+ * 返回值：
+ * 处理函数的返回值，系统调用号无效时返回-1
+ */
+reg_t syscall_dispatch(reg_t a0, reg_t a1, reg_t a2, reg_t a3, reg_t a4, reg_t a5, reg_t nr){
+    if(nr >= SYS_NR){
+        return -1;
+    }
+    return syscall_table[nr](a0, a1, a2, a3, a4, a5);
+}
+
+/* 用户模式任务的例程返回地址，见task_create_user() */
+void usys_exit(void){
+    syscall0(SYS_exit);
+}
+
+/*
+ * 系统调用往返开销测试
+ * 创建一个用户模式的任务连续执行SYSCALL_BENCH_ROUNDS次SYS_null，
+ * 前后各用SYS_cycles读取mcycle，
+ * 用户模式的任务不能访问内核的全局变量，结果写入调用者在堆中分配的syscall_bench_result
+ * 需要在任务中调用，等待期间调用者睡眠
+ */
+#define SYSCALL_BENCH_ROUNDS 1000
+
+struct syscall_bench_result {
+	volatile reg_t cycles;
+	volatile int done;
+};
+
+static void syscall_bench_task(void *param){
+    struct syscall_bench_result *res = (struct syscall_bench_result *)param;
+    reg_t start = syscall0(SYS_cycles);
+    for(int i = 0;i < SYSCALL_BENCH_ROUNDS;i++){
+        syscall0(SYS_null);
+    }
+    reg_t end = syscall0(SYS_cycles);
+    res->cycles = (end - start) / SYSCALL_BENCH_ROUNDS;
+    res->done = 1;
+}
+
+void syscall_bench(){
+    struct syscall_bench_result *res = (struct syscall_bench_result *)malloc(sizeof(struct syscall_bench_result));
+    if(res == NULL){
+        printf("syscall_bench: out of memory\n");
+        return;
+    }
+    res->done = 0;
+    if(task_create_user(syscall_bench_task, res, 0, 0) == NULL){
+        printf("syscall_bench: cannot create task\n");
+        free(res);
+        return;
+    }
+    while(!res->done){
+        task_sleep_us(1000);
+    }
+    printf("ecall round trip: %ld cycles\n", res->cycles);
+    /* 任务在设置done之后还要返回并退出，不再访问res */
+    free(res);
+}
@@ -0,0 +1,158 @@
+#include "../include/os.h"
+
+/*
+ * 定时器相关实现，基于CLINT的mtime/mtimecmp
+ */
+
+/* 默认时间片长度：10ms，单位为mtime的计数周期 */
+#define TIMER_QUANTUM (CLINT_TIMEBASE_FREQ / 100)
+
+/*
+ * 时间片计数由mtime推算，而不是在每次中断时累加，
+ * 这样hart在空闲时停止周期性中断（tickless）也不会丢失计数：
+ * tick = _tick_epoch + (mtime - _mtime_epoch) / _quantum
+ * _tick_epoch/_mtime_epoch：最近一次修改时间片长度时的时间片计数与对应的mtime
+ * _quantum：当前的时间片长度
+ * 所有hart的时间片边界对齐，定时器中断都发生在时间片边界上
+ */
+static uint64_t _tick_epoch = 0;
+static uint64_t _mtime_epoch = 0;
+static uint64_t _quantum = TIMER_QUANTUM;
+
+/* 读取mtime寄存器 */
+uint64_t timer_get_mtime(){
+    return *(volatile uint64_t*)CLINT_MTIME;
+}
+
+/* 返回系统启动以来经过的时间片数 */
+uint64_t timer_get_tick(){
+    return _tick_epoch + (timer_get_mtime() - _mtime_epoch) / _quantum;
+}
+
+/* 返回当前的时间片长度，mtime计数周期 */
+uint64_t timer_get_quantum(){
+    return _quantum;
+}
+
+/* 返回第tick个时间片开始时的mtime */
+static uint64_t tick_to_mtime(uint64_t tick){
+    return _mtime_epoch + (tick - _tick_epoch) * _quantum;
+}
+
+/* 设置本hart的mtimecmp */
+static inline void timer_set_cmp(uint64_t cmp){
+    *(volatile uint64_t*)CLINT_MTIMECMP(r_tp()) = cmp;
+}
+
+static inline uint64_t timer_get_cmp(){
+    return *(volatile uint64_t*)CLINT_MTIMECMP(r_tp());
+}
+
+/*
+ * 装载下一次定时器中断
+ * - interval：距离下一次中断的mtime计数周期数
+ */
+void timer_load(uint64_t interval){
+    timer_set_cmp(timer_get_mtime() + interval);
+}
+
+/*
+ * 在ticks个时间片之后的时间片边界上产生定时器中断
+ * - ticks：时间片数，为0时不再产生定时器中断
+ */
+void timer_load_tick(uint64_t ticks){
+    if(ticks == 0){
+        timer_set_cmp(-1ULL);
+        return;
+    }
+    timer_set_cmp(tick_to_mtime(timer_get_tick() + ticks));
+}
+
+/*
+ * 设置时间片长度，从当前时间片结束时开始生效
+ * 时间片计数以修改时刻所在时间片的结束为新的起点，保证计数连续
+ * 应在系统启动阶段（其它hart读取时间片计数之前）调用
+ * - quantum：时间片长度，单位为mtime的计数周期
+ */
+void timer_set_quantum(uint64_t quantum){
+    if(quantum == 0){
+        return;
+    }
+    uint64_t tick = timer_get_tick() + 1;
+    _mtime_epoch = tick_to_mtime(tick);
+    _tick_epoch = tick;
+    _quantum = quantum;
+}
+
+void timer_init(){
+    /* 装载第一次定时器中断 */
+    timer_load_tick(1);
+
+    /* enable machine-mode timer interrupts. */
+    w_mie(r_mie() | MIE_MTIE);
+}
+
+/*
+ * 时间片到期时由定时器中断处理函数调用：
+ * 装载下一个时间片
+ * 每个hart都有自己的mtimecmp，但定时器轮与任务组的配额只由hart 0处理
+ */
+void timer_tick(){
+    timer_load_tick(1);
+    if(r_tp() == 0){
+        /* 唤醒睡眠到期的任务 */
+        timer_wheel_expire(timer_get_tick());
+        /* 为任务组补充配额 */
+        task_group_refill(timer_get_mtime());
+    }
+}
+
+/*
+ * 空闲的hart进入wfi之前调用，停止周期性的定时器中断
+ * - deadline：下一个真正的定时器期限（时间片计数），为0表示没有期限，
+ *   此时只有其它中断（如核间中断）可以唤醒该hart；
+ *   期限已过时定时器中断立即到来
+ */
+void timer_idle(uint64_t deadline){
+    if(deadline == 0){
+        timer_set_cmp(-1ULL);
+        return;
+    }
+    timer_set_cmp(tick_to_mtime(deadline));
+}
+
+/*
+ * 空闲的hart从wfi返回后调用，恢复周期性的定时器中断
+ * 若定时器中断已经到期（正是它唤醒了hart），保持不变，
+ * 否则提前到下一个时间片边界
+ */
+void timer_idle_exit(){
+    uint64_t next = tick_to_mtime(timer_get_tick() + 1);
+    if(timer_get_cmp() > next){
+        timer_set_cmp(next);
+    }
+}
+
+/* 将微秒换算为mtime的计数周期数 */
+uint64_t timer_us_to_cycles(uint64_t us){
+    return us * CLINT_TIMEBASE_FREQ / 1000000;
+}
+
+/* 将mtime的计数周期数换算为微秒 */
+uint64_t timer_cycles_to_us(uint64_t cycles){
+    return cycles * 1000000 / CLINT_TIMEBASE_FREQ;
+}
+
+/* 将微秒换算为时间片数，向上取整 */
+uint64_t timer_us_to_tick(uint64_t us){
+    uint64_t cycles = timer_us_to_cycles(us);
+    return (cycles + _quantum - 1) / _quantum;
+}
+
+/* 返回mtime所在或之后的第一个时间片边界对应的时间片计数，即向上取整 */
+uint64_t timer_mtime_to_tick(uint64_t mtime){
+    if(mtime <= _mtime_epoch){
+        return _tick_epoch;
+    }
+    return _tick_epoch + (mtime - _mtime_epoch + _quantum - 1) / _quantum;
+}
@@ -12,14 +12,14 @@ reg_t trap_handler(reg_t epc, reg_t cause){
 		/* Asynchronous trap - interrupt */
 		switch (cause_code) {
 		case 3:
-			uart_puts("software interruption!\n");
+			return_pc = Machine_software_handler(epc,cause);
 			break;
 		case 7:
-			uart_puts("timer interruption!\n");
+			return_pc = Machine_timer_handler(epc,cause);
 			break;
 		case 11:
 			uart_puts("external interruption!\n");
-			Machine_external_handler(epc,cause);
+			return_pc = Machine_external_handler(epc,cause);
 			break;
 		default:
 			uart_puts("unknown async exception!\n");
@@ -27,6 +27,11 @@ reg_t trap_handler(reg_t epc, reg_t cause){
 		}
 	} else {
 		/* Synchronous trap - exception */
+		/* 用户模式的任务发生异常时只终止该任务（系统调用不经过这里，见entry.S） */
+		if((r_mstatus() & MSTATUS_MPP) == 0){
+			printf("user task fault, code = %ld, epc = %lx\n", cause_code, epc);
+			return task_fault_exit();
+		}
 		printf("Sync exceptions!, code = %ld\n", cause_code);
         printf("%lx\n",cause);
 		panic("OOPS! What can I do!");
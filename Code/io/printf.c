@@ -109,7 +109,7 @@ static int _vsnprintf(char * out, size_t n, const char* s, va_list vl)
 	return pos;
 }
 
-static char out_buf[1000]; // buffer for _vprintf()
+static char out_buf[1000]; // buffer for _vprintf()，由串口输出锁保护
 
 static int _vprintf(const char* s, va_list vl)
 {
@@ -117,6 +117,8 @@ static int _vprintf(const char* s, va_list vl)
 	 * 首先第一步遍历一遍计算整体的输出长度，
 	 * 如果超过out_buf的限制则无法打印（目前设的是1000字节） 
 	 */
+	/* 格式化与输出都在串口输出锁内进行，多个hart共用out_buf，输出也不会交错 */
+	reg_t flags = uart_lock();
 	int res = _vsnprintf(NULL, -1, s, vl);
 	if (res+1 >= sizeof(out_buf)) {
 		uart_puts("error: output string size overflow\n");
@@ -125,6 +127,7 @@ static int _vprintf(const char* s, va_list vl)
 	/* 将输出字符存入out_buf，然后调用uart打印 */
 	_vsnprintf(out_buf, res + 1, s, vl);
 	uart_puts(out_buf);
+	uart_unlock(flags);
 	return res;
 }
 
@@ -71,8 +71,12 @@
 #define uart_read_reg(reg) (*(UART_REG(reg)))
 #define uart_write_reg(reg, v) (*(UART_REG(reg)) = (v))
 
+/* 收到输入时由uart_isr()置位UART_EV_RX，任务可以用event_wait()等待输入 */
+struct event_group uart_events;
+
 void uart_init()
 {
+	event_init(&uart_events);
 #ifdef K210
 	uarths_init();
 	// sifive_uart_init(K210_UART_BASE_ADDR, k210_get_clk_freq(),
@@ -144,11 +148,43 @@ int uart_putc(char ch)
 #endif
 }
 
+/*
+ * 串口输出锁，使多个hart的输出不会互相交错，持有期间关闭本hart的中断
+ * 同一hart可以重复获取（printf()中调用uart_puts()，或者持有锁时发生异常后panic()），
+ * uart_tx_owner与uart_tx_depth只由持有锁的hart修改
+ */
+static struct spinlock uart_tx_lock;
+static volatile int uart_tx_owner = -1;
+static int uart_tx_depth;
+
+reg_t uart_lock(void)
+{
+	reg_t flags = irq_save();
+	int hart = (int)r_tp();
+	if (uart_tx_owner != hart) {
+		spin_lock(&uart_tx_lock);
+		uart_tx_owner = hart;
+	}
+	uart_tx_depth++;
+	return flags;
+}
+
+void uart_unlock(reg_t flags)
+{
+	if (--uart_tx_depth == 0) {
+		uart_tx_owner = -1;
+		spin_unlock(&uart_tx_lock);
+	}
+	irq_restore(flags);
+}
+
 void uart_puts(char *s)
 {
+	reg_t flags = uart_lock();
 	while (*s) {
 		uart_putc(*s++);
 	}
+	uart_unlock(flags);
 }
 
 int uart_getc(void)
@@ -178,5 +214,6 @@ void uart_isr(void)
 			uart_putc('\n');
 		}
 	}
+	event_set(&uart_events, UART_EV_RX);
 }
 
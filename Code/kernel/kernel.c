@@ -1,22 +1,53 @@
 #include "../include/os.h"
 
+/*
+ * hart 0完成内核初始化后置为KERNEL_STARTED，其它hart才开始运行
+ * 其它hart在hart 0清零.bss之前就开始读取这个变量，因此它必须位于.data：
+ * 初值不为0的变量不会被放入.bss；等待的条件是等于一个特定的值，
+ * 而不是不为0，即使读到的是尚未初始化的内存也不会提前开始
+ */
+#define KERNEL_BOOTING 0x5a5a5a5a
+#define KERNEL_STARTED 0x600d600d
+static volatile int kernel_started = KERNEL_BOOTING;
+
 void start_kernel(void){
     uart_init();
     uart_puts("Hello,RVOS!\n");
+    trace_init();
 
     // page_init();
     // page_test();
     sched_init();
     interrupt_vector_init();
+    timer_init();
     malloc_init();
 
     malloc_test();
+    // switch_bench();
+    // sched_bench();
 
 	// //sched_init();
 
 	os_main();
 
-	task_yield();
+    /* 唤醒其它hart */
+    __sync_synchronize();
+    kernel_started = KERNEL_STARTED;
+
+	sched_start();
 	uart_puts("Would not go here!\n");
     while (1){}; //系统在此空转
-}
\ No newline at end of file
+}
+
+/* hart 0以外的hart从这里进入 */
+void start_kernel_hart(void){
+    while (kernel_started != KERNEL_STARTED){};
+    __sync_synchronize();
+
+    sched_hart_init();
+    interrupt_vector_init();
+    timer_init();
+
+    sched_start();
+    while (1){};
+}
@@ -0,0 +1,87 @@
+#include "../include/os.h"
+
+/*
+ * 跟踪缓冲区的管理与导出，跟踪点见trace.h
+ */
+
+#if KERNEL_TRACE
+/* 全局符号，便于在内存转储或gdb中找到 */
+struct trace_buf trace_bufs[MAXNUM_CPU];
+
+/* 为0时跟踪点不写入记录，导出缓冲区时暂停跟踪 */
+volatile int trace_on = 0;
+
+/* 初始化各hart的缓冲区头部并开始跟踪，由hart 0在启动时调用 */
+void trace_init(){
+    for(int id = 0;id < MAXNUM_CPU;id++){
+        struct trace_buf *buf = &trace_bufs[id];
+        buf->magic = TRACE_MAGIC;
+        buf->hart = id;
+        buf->size = TRACE_BUF_SIZE;
+        buf->rec_size = sizeof(struct trace_rec);
+        buf->timebase = CLINT_TIMEBASE_FREQ;
+        buf->head = 0;
+    }
+    __sync_synchronize();
+    trace_on = 1;
+}
+
+void trace_start(){
+    trace_on = 1;
+}
+
+void trace_stop(){
+    trace_on = 0;
+}
+
+/*
+ * 由trap入口调用（见entry.S），与退出记录配对
+ * 记录中mcause的中断标志（最高位）移到第31位
+ */
+void trace_trap_enter(reg_t cause, reg_t epc){
+    trace_record(TRACE_TRAP_ENTER, (uint32_t)(cause & 0xfff) | (uint32_t)((cause >> 63) << 31), epc);
+}
+
+void trace_trap_exit(reg_t pc){
+    trace_record(TRACE_TRAP_EXIT, 0, pc);
+}
+
+/*
+ * 描述：
+ * 暂停跟踪，以文本形式从UART输出所有hart的缓冲区（从旧到新），然后恢复跟踪
+ * 每个hart的输出格式为：
+ * TRACE BEGIN <hart> <timebase>
+ * <ts> <event> <arg0> <arg1>   （十六进制，每条记录一行）
+ * TRACE END <hart>
+ * 由tools/trace2perfetto.py --uart解析
+ */
+void trace_dump(){
+    trace_on = 0;
+    __sync_synchronize();
+    for(int id = 0;id < MAXNUM_CPU;id++){
+        struct trace_buf *buf = &trace_bufs[id];
+        uint64_t head = buf->head;
+        uint64_t start = head > TRACE_BUF_SIZE ? head - TRACE_BUF_SIZE : 0;
+        printf("TRACE BEGIN %d %ld\n", id, buf->timebase);
+        for(uint64_t i = start;i < head;i++){
+            struct trace_rec *rec = &buf->rec[i & (TRACE_BUF_SIZE - 1)];
+            printf("%lx %x %x %lx\n", rec->ts, rec->event, rec->arg0, rec->arg1);
+        }
+        printf("TRACE END %d\n", id);
+    }
+    trace_on = 1;
+}
+#else
+void trace_init(){
+}
+
+void trace_start(){
+}
+
+void trace_stop(){
+}
+
+void trace_dump(){
+    printf("trace_dump: KERNEL_TRACE is disabled\n");
+}
+#endif
@@ -6,9 +6,14 @@ static reg_t _num_sizes = 0;
 
 /* 设置一个链表头 */
 static struct Block *first_block = NULL;
+
+/* 多个hart共享同一个堆，分配与释放需要互斥 */
+static struct spinlock heap_lock;
 #pragma pack ()
 
 void malloc_init(){
+    spin_init(&heap_lock);
+
     /* 设置堆内存 */
     _num_sizes = (reg_t)HEAP_SIZE;
 
@@ -36,8 +41,9 @@ void malloc_init(){
 /*
  * 分配一个连续的内存块，大小为 size
  * - size：要分配的内存块大小
+ * 调用者需持有heap_lock
  */
-void *malloc(size_t size){
+static void *_malloc(size_t size){
 
     /* 为了保证分配的空间都是8字节对齐的，对未满8字节的空间进行补齐 */
     if (size%8 !=0)
@@ -62,8 +68,6 @@ void *malloc(size_t size){
                      * 此时不需要创建新的链表项。
                      */
                     _set_size(block,tmp);
-                    printf("block_head: 0x%lx\n",block);
-                    printf("block_size: %ld\n",block->size_flag >> 1);
                     /* 因为要返回给用户实际使用的地址，所以 +1 跳过链表头 */
                     return (block + 1);
                 }else{
@@ -79,8 +83,6 @@ void *malloc(size_t size){
                     block->next = new_block;
                     _free_flag(new_block);
                     _set_size(new_block ,(tmp - size - block_head));
-                    printf("block_head: 0x%lx\n",block);
-                    printf("block_size: %ld\n",block->size_flag >> 1);
                     /* 因为要返回给用户实际使用的地址，所以 +1 跳过链表头 */
                     return (block + 1);
                 }
@@ -88,15 +90,15 @@ void *malloc(size_t size){
         }
         block = block->next;
     }
-    printf("当前堆无足够大小的块，无法分配\n");
     return NULL;
 }
 
 /*
  * 释放内存块，同时合并相邻的空闲块
  * - ptr：内存块可分配部分的起始地址
+ * 调用者需持有heap_lock
  */
-void free(void *ptr){
+static void _free(void *ptr){
     /*
      * Assert (TBD) if p is invalid
      */
@@ -105,14 +107,9 @@ void free(void *ptr){
     }
 
     /* 获得该块的描述符 */
-    printf("\n");
     struct Block *block = (struct Block*)(ptr - block_head);
-    printf("block: 0x%lx\n",block);
     struct Block *front_block = block->front;
-    printf("front_block: 0x%lx\n",front_block);
     struct Block *next_block = block->next;
-    printf("next_block: 0x%lx\n",next_block);
-    printf("\n");
     
     /* 首先查看后一块内存是否空闲，空闲即合并，再查看前一块 */
     if(_is_free(next_block)){
@@ -126,17 +123,12 @@ void free(void *ptr){
 
         reg_t block_size = (block->size_flag >> 1);
         reg_t next_block_size = (next_block->size_flag >> 1);
-        printf("block_size: %ld ,next_block_size: %ld\n",block_size,next_block_size);
         _set_size(block ,(block_size + next_block_size + block_head));
         _clear(next_block);
         _free_flag(block);
-
-        reg_t new_block_size = block->size_flag >> 1;
-        printf("block = 0x%lx, block->next = 0x%lx, new_block_size = %ld\n", block, block->next, new_block_size);
     }
     if(front_block == NULL){
         _free_flag(block);
-        printf("\n");
         return;
     }else if(_is_free(front_block)){
         front_block->next = block->next;
@@ -149,17 +141,43 @@ void free(void *ptr){
 
         reg_t block_size = (block->size_flag >> 1);
         reg_t front_block_size = (front_block->size_flag >> 1);
-        printf("front_block_size: %ld ,block_size: %ld\n",front_block_size,block_size);
         _set_size(front_block,(front_block_size + block_size + block_head));
         _clear(block);
         _free_flag(front_block);
-        
-        reg_t new_front_block_size = front_block->size_flag >> 1;
-        printf("front_block = 0x%lx, front_block->next = 0x%lx, new_front_block_size = %ld\n", front_block, front_block->next, new_front_block_size);
     }else{
         _free_flag(block);
     }
-    printf("\n");
+}
+
+/*
+ * 分配一个连续的内存块，大小为 size
+ * - size：要分配的内存块大小
+ */
+void *malloc(size_t size){
+    reg_t flags = irq_save();
+    spin_lock(&heap_lock);
+    void *p = _malloc(size);
+    spin_unlock(&heap_lock);
+    irq_restore(flags);
+    /* 持有heap_lock时不输出，避免在关中断时等待串口 */
+    if(p == NULL){
+        printf("当前堆无足够大小的块，无法分配\n");
+    }
+    TRACE(TRACE_MALLOC, size, p);
+    return p;
+}
+
+/*
+ * 释放内存块，同时合并相邻的空闲块
+ * - ptr：内存块可分配部分的起始地址
+ */
+void free(void *ptr){
+    TRACE(TRACE_FREE, 0, ptr);
+    reg_t flags = irq_save();
+    spin_lock(&heap_lock);
+    _free(ptr);
+    spin_unlock(&heap_lock);
+    irq_restore(flags);
 }
 
 void malloc_test(){
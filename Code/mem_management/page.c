@@ -83,11 +83,14 @@ void *page_alloc(int npages){
                 /* 设置内存块的最后一页为最后一页 */
                 page_k--;
                 _set_flag(page_k,PAGE_LAST);
-                return (void *)(_alloc_start + i * PAGE_SIZE);
+                void *p = (void *)(_alloc_start + i * PAGE_SIZE);
+                TRACE(TRACE_PAGE_ALLOC, npages, p);
+                return p;
             }
         }
         page_i++;
     }    
+    TRACE(TRACE_PAGE_ALLOC, npages, 0);
     return NULL;
 }
 
@@ -102,6 +105,7 @@ void page_free(void *p){
     if(!p || (reg_t)p >= _alloc_end){
         return;
     }
+    TRACE(TRACE_PAGE_FREE, 0, p);
     /* 获得该内存块的第一页描述符 */
     struct Page *page = (struct Page *)HEAP_START;
     page += ((reg_t)p - _alloc_start)/ PAGE_SIZE;
@@ -105,6 +105,14 @@ static inline void k210_write_sysreg(uint32_t val, uint32_t reg)
 #define PLIC_BASE	0x0C000000ULL
 #endif
 
+/*
+ * CLINT基址与mtime计数频率，寄存器偏移见qemu_virt.h
+ */
+#ifdef K210
+#define CLINT_BASE	K210_CLINT_BASE_ADDR
+#define CLINT_TIMEBASE_FREQ	K210_ACLINT_MTIMER_FREQ
+#endif
+
 /************************************************************/
 /* plic */
 
@@ -63,4 +63,29 @@
 #define PLIC_BASE 0x0c000000L
 #endif
 
+/*
+ * CLINT（Core Local Interruptor）块中包含了定时器相关的寄存器
+ * see https://github.com/qemu/qemu/blob/master/include/hw/riscv/sifive_clint.h
+ * enum {
+ *     SIFIVE_SIP_BASE     = 0x0,
+ *     SIFIVE_TIMECMP_BASE = 0x4000,
+ *     SIFIVE_TIME_BASE    = 0xBFF8
+ * };
+ * 
+ * enum {
+ *     SIFIVE_CLINT_TIMEBASE_FREQ = 10000000
+ * };
+ * 
+ * mtime为全局唯一的64位计时器，上电后以固定频率递增；
+ * 每个hart有一个64位的mtimecmp，当 mtime >= mtimecmp 时触发定时器中断
+ * K210与QEMU-virt的CLINT布局相同，仅基址与计数频率由各平台头文件定义
+ */
+#ifdef QEMU
+#define CLINT_BASE 0x2000000L
+#define CLINT_TIMEBASE_FREQ 10000000
+#endif
+#define CLINT_MSIP(hartid) (CLINT_BASE + 4 * (hartid))
+#define CLINT_MTIMECMP(hartid) (CLINT_BASE + 0x4000 + 8 * (hartid))
+#define CLINT_MTIME (CLINT_BASE + 0xBFF8) // cycles since boot.
+
 #endif
\ No newline at end of file
@@ -1,63 +1,759 @@
 #include "task_schedule.h"
 
-/* 定义每一个任务的结构体 */
-struct Task
-{
-	uint8_t task_stack[STACK_SIZE];
-	uint8_t priority;
-	struct context ctx_tasks;
-	struct Task *front;
-	struct Task *next;
+/*
+ * 每个hart的调度状态
+ * lock：保护就绪队列，其它hart窃取任务或创建任务时也需要获取
+ * ready_queue[i]指向优先级i的FIFO队列的队首，队列由front/next组成双向循环链表，
+ * 队首的front即为队尾，因此入队与出队均为O(1)
+ * ready_bitmap的第i位为1表示优先级i的队列非空，
+ * 通过查找最低的被置位的位即可O(1)地得到最高优先级
+ * nr_ready：就绪队列中的任务数（包括正在运行的任务）
+ * now_priority：指定当前的任务优先级
+ * now_task：指向当前任务的结构体，无任务可运行时指向idle_task，
+ * 为NULL时hart运行在schedule_context中（启动阶段或任务切换途中）
+ * schedule_context：hart启动后的内核上下文，进入调度后不再恢复
+ * idle_task：本hart的空闲任务，不在就绪队列中，也不会被其它hart窃取
+ * edf_rq：SCHED_EDF任务的就绪队列，优先于所有固定优先级的队列
+ * edf_count：已经准入该hart的EDF任务数（包括阻塞中的），由edf_admit_lock保护，
+ *   与edf_rq.util一起用于准入控制
+ * fair_rq：SCHED_FAIR任务的就绪队列，只在没有其它就绪任务时使用
+ * exec_start/exec_start_cycle：当前任务本次开始运行（或上次记账）时的mtime与mcycle
+ * zombie_task：已经退出但内存尚未回收的任务
+ * 任务退出时仍运行在自己的栈上，无法释放自身，
+ * 因此延迟到下一次调度时回收，每个hart任一时刻最多只有一个
+ */
+struct hart {
+	struct spinlock lock;
+	struct Task *ready_queue[Priority_num];
+	uint64_t     ready_bitmap;
+	volatile int nr_ready;
+	uint8_t      now_priority;
+	struct Task *now_task;
+	struct context schedule_context;
+	struct Task idle_task;
+	struct edf_rq edf_rq;
+	int          edf_count;
+	struct fair_rq fair_rq;
+	uint64_t     exec_start;
+	uint64_t     exec_start_cycle;
+#if SCHED_ACCT
+	uint64_t     exec_start_instret;
+#endif
+	struct Task *zombie_task;
+	volatile int online;
+
+	/*
+	 * 看门狗，见watchdog_tick()
+	 * dispatch_time：now_task本次开始占用CPU的mtime
+	 * wd_fired：now_task本次占用CPU超时已被记录
+	 * wd_parked：因超时被罚停一个时间片的任务
+	 * wd_remote_stamp：hart 0代为记录的（关中断的）超时对应的dispatch_time
+	 */
+	volatile uint64_t dispatch_time;
+	volatile int wd_fired;
+	struct Task *wd_parked;
+	uint64_t     wd_remote_stamp;
+
+	/*
+	 * switch_count：任务切换次数（主动让出与抢占）
+	 * quantum_expire_count：时间片到期次数
+	 * preempt_count：时间片到期后实际发生抢占的次数
+	 * irq_preempt_count：中断处理函数唤醒的任务在中断返回时抢占当前任务的次数
+	 * steal_count：从其它hart窃取任务的次数
+	 * idle_count：空闲任务进入wfi的次数
+	 * yield_to_count：通过task_yield_to()直接切换的次数
+	 * edf_miss_count：EDF任务的作业错过截止时间的次数
+	 */
+	uint64_t switch_count;
+	uint64_t quantum_expire_count;
+	uint64_t preempt_count;
+	uint64_t irq_preempt_count;
+	uint64_t steal_count;
+	uint64_t idle_count;
+	uint64_t yield_to_count;
+	uint64_t edf_miss_count;
 };
 
-/* K210强制要求字节对齐 */
+/*
+ * K210强制要求字节对齐
+ * harts[MAXNUM_CPU]只供sched_bench()使用，不会上线，也不参与调度与负载均衡，
+ * 放在数组中是为了让测试任务的hart字段（h - harts）仍然是有效的下标
+ */
 #pragma pack (8)
-/* 定义schedule函数自己的上下文和栈空间 */
-struct context   schedule_context;
-uint8_t          schedule_stack[STACK_SIZE];
+static struct hart harts[MAXNUM_CPU + 1];
+#define BENCH_HART MAXNUM_CPU
+
+/* task_num：保存当前系统中的任务总数 */
+int task_num = 0;
+#pragma pack ()
+
+/*
+ * 各hart的重新调度请求，由task_wakeup()置位，
+ * trap返回路径（entry.S）发现置位时调用sched_irq_exit()，
+ * 按hart编号以8字节为单位访问
+ */
+volatile reg_t sched_need_resched[MAXNUM_CPU];
 
-/* 定义exit函数自己的上下文和栈空间 */
-struct context   exit_context;
-uint8_t          exit_stack[STACK_SIZE];
+/*
+ * task_list：所有任务（不包括空闲任务）组成的链表，由task_list_lock保护
+ * next_tid：下一个任务编号
+ */
+static struct Task *task_list = NULL;
+static struct spinlock task_list_lock;
+static uint32_t next_tid = 1;
 
-/* 定义内核上下文 */
-struct context kernel_context;
+#if SCHED_ACCT
+/* 保护task_top()使用的快照缓冲区 */
+static struct mutex top_mutex;
+#endif
 
-/* 定义管理任务的优先级数组 */
-struct Task      task_priority_array[Priority_num];
+/* 保护各hart的EDF准入状态（edf_count与edf_rq.util） */
+static struct spinlock edf_admit_lock;
 
 /*
- * now_priority：指定当前的任务优先级
- * now_task：指向当前任务的结构体
+ * 空闲任务的栈，每个栈的开头STACK_GUARD字节为保护区，按保护区的大小对齐
+ * 每个元素的大小向上取整为STACK_GUARD的倍数，使每个hart的保护区都满足PMP表项0的NAPOT对齐
  */
-static uint8_t   now_priority; 
-static struct Task *now_task;
+#define IDLE_STACK_MEM ((STACK_MEM_SIZE(STACK_SIZE) + STACK_GUARD - 1) & ~(STACK_GUARD - 1))
+static uint8_t idle_stacks[MAXNUM_CPU][IDLE_STACK_MEM] __attribute__((aligned(STACK_GUARD)));
 
-/* task_num：保存当前系统中的任务总数 */
-int task_num = 0;
-#pragma pack ()
+/* 保护stack_stat()使用的快照缓冲区 */
+static struct mutex stack_mutex;
+
+/* 返回当前hart的调度状态，调用者需要关闭中断，防止任务被迁移到其它hart */
+static inline struct hart *this_hart(){
+    return &harts[r_tp()];
+}
+
+static void idle_main(void *param);
+static void wd_unpark(struct hart *h);
+
+/*
+ * 设置任务的栈与上下文：用STACK_FILL填充保护区与栈，
+ * 上下文放在栈顶之上，sp指向栈顶
+ * 上下文只在切换到该任务时访问，与栈放在一起，不占用任务控制块的缓存行
+ * - mem：按STACK_GUARD对齐、大小为STACK_MEM_SIZE(size)的内存
+ * - size：栈的大小，16字节对齐
+ */
+static void stack_setup(struct Task *task, uint8_t *mem, uint32_t size){
+    uint64_t *p = (uint64_t *)mem;
+    for(uint32_t i = 0;i < (STACK_GUARD + size) / 8;i++){
+        p[i] = STACK_FILL;
+    }
+    task->stack_base = mem + STACK_GUARD;
+    task->stack_size = size;
+    task->ctx = (struct context *)(task->stack_base + size);
+    task->ctx->sp = (reg_t)task->ctx;
+}
+
+/*
+ * 检查任务的栈保护区是否被改写，被改写说明栈已经溢出
+ * 在任务被切换出去时调用
+ * 超过STACK_GUARD字节的栈帧可能越过保护区而不改写它，因此还要检查sp：
+ * 切换时仍在任务的栈（用户模式的任务为内核栈）上运行，sp不能低于栈底
+ * - sp：当前的sp，不在该任务的栈上运行时（sched_bench()）为0，不检查
+ */
+static inline void stack_check(struct Task *task, reg_t sp){
+    uint64_t *guard = (uint64_t *)(task->stack_base - STACK_GUARD);
+    uint8_t *bottom = task->stack_base;
+    /* 用户模式的任务还要检查内核栈底部的STACK_GUARD字节 */
+    uint64_t *kguard = guard;
+    if(task->ctx->kstack != 0){
+        kguard = (uint64_t *)(task->stack_base - KSTACK_SIZE);
+        bottom = (uint8_t *)kguard + STACK_GUARD;
+    }
+    int overflow = sp != 0 && sp < (reg_t)bottom;
+    for(int i = 0;i < STACK_GUARD / 8;i++){
+        if(guard[i] != STACK_FILL || kguard[i] != STACK_FILL){
+            overflow = 1;
+        }
+    }
+    if(overflow){
+        printf("task %d: stack overflow, size %d\n", task->tid, task->stack_size);
+        panic("stack overflow");
+    }
+}
+
+/*
+ * 将即将运行的任务的栈保护区装入本hart的PMP表项0（无任何权限）
+ * 用户模式的任务的保护区与其下的内核栈一起装入
+ * 未锁定的PMP表项只约束S/U模式，机器模式的任务依靠stack_check()发现溢出
+ */
+static inline void stack_guard_load(struct Task *task){
+#ifdef QEMU
+    if(task->ctx->kstack != 0){
+        w_pmpaddr0(PMP_NAPOT_ADDR(task->stack_base - KSTACK_SIZE, KSTACK_SIZE));
+    }else{
+        w_pmpaddr0(PMP_NAPOT_ADDR(task->stack_base - STACK_GUARD, STACK_GUARD));
+    }
+#endif
+}
+
+/* 返回任务栈的最大使用量：从栈底开始仍保持填充值的部分从未被使用过 */
+static uint32_t stack_used(struct Task *task){
+    uint64_t *p = (uint64_t *)task->stack_base;
+    uint32_t n = task->stack_size / 8;
+    uint32_t i = 0;
+    while(i < n && p[i] == STACK_FILL){
+        i++;
+    }
+    return (n - i) * 8;
+}
+
+/*
+ * 任务控制块池
+ * 任务控制块按TCB_CHUNK个一组从堆中分配，组内连续存放并按缓存行对齐，
+ * 遍历就绪队列时每个任务只访问一个缓存行；
+ * 释放的任务控制块回到空闲链表（通过next链接）供之后复用，不归还给堆，
+ * 空闲链表由tcb_lock保护
+ */
+static struct Task *tcb_free_list = NULL;
+static struct spinlock tcb_lock;
+
+static void tcb_init(){
+    spin_init(&tcb_lock);
+}
+
+/* 从堆中分配一组任务控制块放入空闲链表，内存不足时返回-1 */
+static int tcb_grow(){
+    void *mem = malloc(TCB_CHUNK * sizeof(struct Task) + CACHE_LINE);
+    if(mem == NULL){
+        return -1;
+    }
+    struct Task *chunk = (struct Task *)(((reg_t)mem + CACHE_LINE - 1) & ~(reg_t)(CACHE_LINE - 1));
+    reg_t flags = irq_save();
+    spin_lock(&tcb_lock);
+    for(int i = TCB_CHUNK - 1;i >= 0;i--){
+        chunk[i].next = tcb_free_list;
+        tcb_free_list = &chunk[i];
+    }
+    spin_unlock(&tcb_lock);
+    irq_restore(flags);
+    return 0;
+}
+
+/* 分配一个任务控制块，空闲链表为空时从堆中补充，内存不足时返回NULL */
+static struct Task *tcb_alloc(){
+    while(1){
+        reg_t flags = irq_save();
+        spin_lock(&tcb_lock);
+        struct Task *task = tcb_free_list;
+        if(task != NULL){
+            tcb_free_list = task->next;
+        }
+        spin_unlock(&tcb_lock);
+        irq_restore(flags);
+        if(task != NULL){
+            return task;
+        }
+        if(tcb_grow() != 0){
+            return NULL;
+        }
+    }
+}
+
+static void tcb_free(struct Task *task){
+    reg_t flags = irq_save();
+    spin_lock(&tcb_lock);
+    task->next = tcb_free_list;
+    tcb_free_list = task;
+    spin_unlock(&tcb_lock);
+    irq_restore(flags);
+}
+
+/* 释放任务与它的栈 */
+static void task_free(struct Task *task){
+    free(task->stack_mem);
+    tcb_free(task);
+}
+
+/* 设置当前hart的mscratch与空闲任务，并标记该hart可以参与调度 */
+void sched_hart_init(){
+    struct hart *h = this_hart();
+    struct Task *idle = &h->idle_task;
+    stack_setup(idle, idle_stacks[h - harts], STACK_SIZE);
+    idle->stack_mem = NULL;
+    idle->ctx->ra = 0;
+    idle->ctx->pc = (reg_t) idle_main;
+    idle->ctx->flag = CTX_FULL;
+    idle->ctx->running = 0;
+    idle->ctx->mpp = MSTATUS_MPP;
+    idle->ctx->kstack = 0;
+    idle->priority = Priority_num - 1;
+    idle->base_priority = Priority_num - 1;
+    idle->hart = h - harts;
+    idle->state = TASK_READY;
+    idle->policy = SCHED_PRIO;
+    idle->on_rq = 0;
+    idle->group = NULL;
+    idle->tid = 0;
+#if SCHED_LATENCY
+    idle->wake_time = 0;
+#endif
+    idle->entry = idle_main;
+    idle->expire_tick = 0;
+    idle->front = NULL;
+    idle->next = NULL;
+
+#ifdef QEMU
+    /* PMP表项0作为正在运行的任务的栈保护区，见stack_guard_load() */
+    stack_guard_load(idle);
+    /* 其余PMP表项限定用户模式的任务可以访问的内存，见user_pmp_init() */
+    user_pmp_init();
+#endif
 
-/* schedule初始化 */
-void sched_init(){
     /* 设置mscratch寄存器初值 */
-    w_mscratch(&kernel_context);
-    /* 初始化任务优先级数组 */
+    w_mscratch((reg_t)&h->schedule_context);
+    __sync_synchronize();
+    h->online = 1;
+}
+
+/* 初始化hart的就绪队列与调度状态 */
+static void hart_init(struct hart *h){
+    spin_init(&h->lock);
+    /* 初始化就绪队列 */
     for(int i = 0;i < Priority_num;i++){
-        task_priority_array[i].next = NULL;
-    }
-    
-    /* 设置schedule函数的上下文 */
-    /* 栈空间减8满足K210的字节对齐要求 */
-    schedule_context.ra = &schedule;
-    schedule_context.sp = &schedule_stack[STACK_SIZE - 8];
-    
-    /* 设置exit函数的上下文 */
-    exit_context.sp = &exit_stack[STACK_SIZE - 8];
-    exit_context.ra = &exit;
+        h->ready_queue[i] = NULL;
+    }
+    h->ready_bitmap = 0;
+    h->nr_ready = 0;
+    edf_rq_init(&h->edf_rq);
+    h->edf_count = 0;
+    fair_rq_init(&h->fair_rq);
+    h->exec_start = 0;
+    h->exec_start_cycle = 0;
 
     /* 初始化now_priority和now_task指针 */
-    now_priority = 0;
-    now_task = NULL;
+    h->now_priority = 0;
+    h->now_task = NULL;
+    h->zombie_task = NULL;
+    h->online = 0;
+    h->dispatch_time = 0;
+    h->wd_fired = 0;
+    h->wd_parked = NULL;
+    h->wd_remote_stamp = 0;
+}
+
+/* schedule初始化，由hart 0调用 */
+void sched_init(){
+    for(int id = 0;id < MAXNUM_CPU;id++){
+        hart_init(&harts[id]);
+    }
+    tcb_init();
+#if SCHED_ACCT
+    mutex_init(&top_mutex);
+#endif
+    mutex_init(&stack_mutex);
+    sched_hart_init();
+}
+
+/* 更新h的min_vruntime，使其单调不减地跟随队列中最小的vruntime */
+static void fair_update_min(struct hart *h){
+    struct Task *first = fair_rq_first(&h->fair_rq);
+    if(first != NULL && (int64_t)(first->fair.vruntime - h->fair_rq.min_vruntime) > 0){
+        h->fair_rq.min_vruntime = first->fair.vruntime;
+    }
+}
+
+/*
+ * 将任务插入hart对应优先级队列的队尾，调用者需持有h->lock
+ * EDF任务插入EDF堆，公平调度的任务插入按vruntime排序的树堆
+ */
+static void rq_enqueue(struct hart *h, struct Task *task){
+    task->hart = h - harts;
+    task->on_rq = 1;
+    h->nr_ready++;
+    if(task->policy == SCHED_EDF){
+        edf_rq_insert(&h->edf_rq, task);
+        return;
+    }
+    if(task->policy == SCHED_FAIR){
+        /* 离开队列时保存的是相对值，睡眠过久的任务最多获得FAIR_WAKEUP_CREDIT的补偿 */
+        int64_t lag = (int64_t)task->fair.vruntime;
+        if(lag < -(int64_t)FAIR_WAKEUP_CREDIT){
+            lag = -(int64_t)FAIR_WAKEUP_CREDIT;
+        }
+        task->fair.vruntime = h->fair_rq.min_vruntime + lag;
+        fair_rq_insert(&h->fair_rq, task);
+        return;
+    }
+
+    uint8_t prio = task->priority;
+    struct Task *head = h->ready_queue[prio];
+    if(head == NULL){
+        task->next = task;
+        task->front = task;
+        h->ready_queue[prio] = task;
+        h->ready_bitmap |= (1ULL << prio);
+    }else{
+        task->front = head->front;
+        task->next = head;
+        head->front->next = task;
+        head->front = task;
+    }
+}
+
+/* 将任务从hart的就绪队列中移除，调用者需持有h->lock */
+static void rq_dequeue(struct hart *h, struct Task *task){
+    task->on_rq = 0;
+    h->nr_ready--;
+    if(task->policy == SCHED_EDF){
+        edf_rq_remove(&h->edf_rq, task);
+        return;
+    }
+    if(task->policy == SCHED_FAIR){
+        fair_rq_remove(&h->fair_rq, task);
+        fair_update_min(h);
+        task->fair.vruntime -= h->fair_rq.min_vruntime;
+        return;
+    }
+
+    uint8_t prio = task->priority;
+    if(task->next == task){
+        /* 队列中只有该任务，清空该优先级 */
+        h->ready_queue[prio] = NULL;
+        h->ready_bitmap &= ~(1ULL << prio);
+    }else{
+        if(h->ready_queue[prio] == task){
+            h->ready_queue[prio] = task->next;
+        }
+        task->front->next = task->next;
+        task->next->front = task->front;
+    }
+    task->next = NULL;
+    task->front = NULL;
+}
+
+/*
+ * 正在运行的任务位于其队列的队首，让出CPU时将其轮转到队尾
+ * 调用者需持有h->lock
+ */
+static void rq_rotate_current(struct hart *h){
+    /* 获取当前正在执行的任务 */
+    struct Task *task = h->now_task;
+    if(task != NULL && h->ready_queue[task->priority] == task){
+        h->ready_queue[task->priority] = task->next;
+    }
+}
+
+/*
+ * 为当前任务记账：将上次记账以来经过的时间计入当前任务
+ * 公平调度的任务按照权重累加vruntime（以mcycle计），并重新排入树堆；
+ * EDF任务的预算耗尽时，截止时间推迟一个周期并补充预算（CBS），
+ * 重新排入EDF堆，这样超出预算的作业只会使用后续周期的带宽
+ * 在每次选择下一个任务之前调用，调用者需持有h->lock
+ */
+static void update_curr(struct hart *h){
+    uint64_t now = timer_get_mtime();
+    uint64_t delta = now - h->exec_start;
+    uint64_t cycle = r_mcycle();
+    uint64_t delta_cycle = cycle - h->exec_start_cycle;
+    h->exec_start = now;
+    h->exec_start_cycle = cycle;
+#if SCHED_ACCT
+    uint64_t instret = r_minstret();
+    uint64_t delta_instret = instret - h->exec_start_instret;
+    h->exec_start_instret = instret;
+#endif
+
+    struct Task *task = h->now_task;
+    if(task == NULL){
+        return;
+    }
+#if SCHED_ACCT
+    task->acct.cycles += delta_cycle;
+    task->acct.instret += delta_instret;
+    task->acct.run_time += delta;
+#endif
+    if(task->group != NULL){
+        task_group_charge(task->group, delta);
+    }
+    if(task->policy == SCHED_FAIR){
+        uint64_t delta_vruntime = delta_cycle * FAIR_WEIGHT_0 / task->fair.weight;
+        if(task->on_rq){
+            fair_rq_remove(&h->fair_rq, task);
+            task->fair.vruntime += delta_vruntime;
+            fair_rq_insert(&h->fair_rq, task);
+            fair_update_min(h);
+        }
+        return;
+    }
+    if(task->policy != SCHED_EDF){
+        return;
+    }
+    task->edf.budget_left -= delta;
+    if(task->edf.budget_left > 0){
+        return;
+    }
+    task->edf.overrun_count++;
+    if(task->on_rq){
+        edf_rq_remove(&h->edf_rq, task);
+    }
+    while(task->edf.budget_left <= 0){
+        task->edf.deadline += task->edf.period;
+        task->edf.budget_left += task->edf.budget;
+    }
+    if(task->on_rq){
+        edf_rq_insert(&h->edf_rq, task);
+    }
+}
+
+/*
+ * 开始EDF任务的一个新作业：设置截止时间并补充预算
+ * 任务在EDF堆中时需要重新调整位置，调用者需持有h->lock
+ */
+static void edf_start_job(struct hart *h, struct Task *task, uint64_t release){
+    if(task->on_rq){
+        edf_rq_remove(&h->edf_rq, task);
+    }
+    task->edf.release = release;
+    task->edf.job_deadline = release + task->edf.rel_deadline;
+    task->edf.deadline = task->edf.job_deadline;
+    task->edf.budget_left = task->edf.budget;
+    if(task->on_rq){
+        edf_rq_insert(&h->edf_rq, task);
+    }
+}
+
+#if SCHED_ACCT
+/*
+ * 切换任务时更新就绪等待时间：next结束等待，仍然就绪的prev开始等待
+ * 时间取update_curr()记录的exec_start，调用者需持有h->lock
+ */
+static inline void acct_switch(struct hart *h, struct Task *prev, struct Task *next){
+    if(prev == next){
+        return;
+    }
+    if(prev != NULL && prev->on_rq && prev->state == TASK_READY){
+        prev->acct.ready_since = h->exec_start;
+    }
+    next->acct.ready_time += h->exec_start - next->acct.ready_since;
+}
+#endif
+
+#if SCHED_LATENCY
+/*
+ * 任务被调度运行时，若它是被唤醒后第一次运行，记录唤醒到运行的延迟
+ * 时间取update_curr()记录的exec_start，调用者需持有h->lock
+ */
+static inline void lat_dispatch(struct hart *h, struct Task *next){
+    if(next->wake_time != 0){
+        uint64_t delta = h->exec_start > next->wake_time ? h->exec_start - next->wake_time : 0;
+        lat_record(h - harts, next->priority, delta);
+        next->wake_time = 0;
+    }
+}
+#endif
+
+/*
+ * 即将从prev切换到next时调用，调用者需持有h->lock
+ * 检查prev的栈，装载next的栈保护区，并为看门狗记录next开始占用CPU的时间
+ */
+static inline void task_switch_in(struct hart *h, struct Task *prev, struct Task *next){
+    if(prev != NULL){
+        stack_check(prev, h == this_hart() ? r_sp() : 0);
+    }
+    stack_guard_load(next);
+    h->dispatch_time = h->exec_start;
+    h->wd_fired = 0;
+    TRACE(TRACE_SWITCH, prev != NULL ? prev->tid : 0, next->tid);
+}
+
+/*
+ * 任务所属的任务组已经用完配额时，将任务移出就绪队列，
+ * 交给任务组在补充配额时唤醒，见group.c
+ * 正在准备阻塞（TASK_BLOCKED但仍在就绪队列中）的任务即将离开就绪队列，不需要处理
+ * 调用者需持有h->lock
+ * 返回值：
+ * 1：任务已被节流
+ * 0：任务可以运行
+ */
+static int throttle_task(struct hart *h, struct Task *task){
+    struct task_group *g = task->group;
+    if(g == NULL || !*(volatile int *)&g->throttled || task->state != TASK_READY){
+        return 0;
+    }
+    if(!task_group_park(g, task)){
+        return 0;
+    }
+    rq_dequeue(h, task);
+    task->state = TASK_BLOCKED;
+    return 1;
+}
+
+/*
+ * 选出下一个要运行的任务，同时更新now_task和now_priority
+ * 有就绪的EDF任务时选择截止时间最早的EDF任务，
+ * 否则正在运行的任务位于其队列的队首，让出CPU时将其轮转到队尾，
+ * 然后取最高优先级队列的队首，
+ * 都没有时选择vruntime最小的公平调度任务
+ * 选中的任务所属的任务组已被节流时，将其移出就绪队列后重新选择
+ * 调用者需持有h->lock
+ * 返回值：
+ * 下一个任务，若无任务返回本hart的空闲任务
+ */
+static struct Task *__pick_next_task(struct hart *h, int rotate){
+    struct Task *prev = h->now_task;
+    update_curr(h);
+    if(rotate){
+        rq_rotate_current(h);
+    }
+    do{
+        struct Task *edf = edf_rq_first(&h->edf_rq);
+        if(edf != NULL){
+            h->now_priority = 0;
+            h->now_task = edf;
+        }else if(h->ready_bitmap != 0){
+            h->now_priority = __ffs64(h->ready_bitmap);
+            h->now_task = h->ready_queue[h->now_priority];
+        }else if(h->fair_rq.nr != 0){
+            h->now_priority = Priority_num - 1;
+            h->now_task = fair_rq_first(&h->fair_rq);
+        }else{
+            /* 若无任务，则运行空闲任务 */
+            h->now_priority = Priority_num - 1;
+            h->now_task = &h->idle_task;
+        }
+    }while(throttle_task(h, h->now_task));
+#if SCHED_ACCT
+    acct_switch(h, prev, h->now_task);
+#endif
+#if SCHED_LATENCY
+    lat_dispatch(h, h->now_task);
+#endif
+    if(prev != h->now_task){
+        task_switch_in(h, prev, h->now_task);
+    }
+    /* 在上下文被其它hart恢复之前标记为正在运行，防止被窃取 */
+    h->now_task->ctx->running = 1;
+    return h->now_task;
+}
+
+static struct Task *pick_next_task(struct hart *h){
+    return __pick_next_task(h, 1);
+}
+
+/*
+ * 从就绪任务最多的hart窃取一个任务放入h的就绪队列
+ * 只有当对方的任务数比h至少多2个时才窃取，避免任务在hart之间来回迁移
+ * EDF任务固定在准入的hart上，不会被窃取
+ * 正在运行的任务，以及上下文尚未保存完毕（running不为0）的任务不能被窃取
+ * 调用者需关闭中断，且不能持有任何就绪队列的锁
+ * 返回值：
+ * 被窃取的任务，若没有可窃取的任务返回NULL
+ */
+static struct Task *steal_task(struct hart *h){
+    struct hart *victim = NULL;
+    int max = h->nr_ready + 1;
+    for(int id = 0;id < MAXNUM_CPU;id++){
+        struct hart *other = &harts[id];
+        if(other != h && other->online && other->nr_ready > max){
+            victim = other;
+            max = other->nr_ready;
+        }
+    }
+    if(victim == NULL){
+        return NULL;
+    }
+
+    struct Task *stolen = NULL;
+    spin_lock(&victim->lock);
+    uint64_t bitmap = victim->ready_bitmap;
+    while(bitmap != 0 && stolen == NULL){
+        int prio = __ffs64(bitmap);
+        bitmap &= bitmap - 1;
+        /* 从队尾开始查找，队尾的任务最久没有运行过 */
+        struct Task *tail = victim->ready_queue[prio]->front;
+        struct Task *t = tail;
+        do{
+            if(t != victim->now_task && *(volatile reg_t *)&t->ctx->running == 0){
+                stolen = t;
+                break;
+            }
+            t = t->front;
+        }while(t != tail);
+    }
+    /* 没有固定优先级的任务可窃取时，窃取vruntime最小的公平调度任务 */
+    struct Task *t = fair_rq_first(&victim->fair_rq);
+    while(stolen == NULL && t != NULL){
+        if(t != victim->now_task && *(volatile reg_t *)&t->ctx->running == 0){
+            stolen = t;
+        }
+        t = fair_rq_next(&victim->fair_rq, t);
+    }
+    if(stolen != NULL){
+        rq_dequeue(victim, stolen);
+        /* 持有victim的锁时就改为新的hart，见task_set_priority() */
+        stolen->hart = h - harts;
+    }
+    spin_unlock(&victim->lock);
+
+    if(stolen != NULL){
+        spin_lock(&h->lock);
+        rq_enqueue(h, stolen);
+        h->steal_count++;
+        spin_unlock(&h->lock);
+    }
+    return stolen;
+}
+
+/* 为h选出下一个任务，本hart无任务时尝试窃取，调用者需关闭中断 */
+static struct Task *find_next_task(struct hart *h){
+    spin_lock(&h->lock);
+    struct Task *next = pick_next_task(h);
+    spin_unlock(&h->lock);
+
+    if(next == &h->idle_task && steal_task(h) != NULL){
+        spin_lock(&h->lock);
+        next = pick_next_task(h);
+        spin_unlock(&h->lock);
+    }
+    return next;
+}
+
+/* 回收本hart上已退出任务的内存 */
+static void reap_zombie(){
+    reg_t flags = irq_save();
+    struct hart *h = this_hart();
+    struct Task *task = h->zombie_task;
+    h->zombie_task = NULL;
+    irq_restore(flags);
+
+    if(task != NULL){
+        task_free(task);
+    }
+}
+
+/*
+ * 实现任务调度
+ * 在让出CPU的任务自己的上下文中选出下一个任务，
+ * 然后直接切换过去，只需一次上下文保存与恢复
+ * 若没有任务可以运行，切换到本hart的空闲任务
+ */
+void schedule(){
+    reg_t flags = irq_save();
+    struct hart *h = this_hart();
+    struct Task *task = h->now_task;
+    struct Task *next = find_next_task(h);
+
+    /* 只有当前任务可以运行时不需要切换 */
+    if(next != task){
+        h->switch_count++;
+#if SCHED_ACCT
+        /* sched_start()第一次调度时还没有当前任务 */
+        if(task != NULL){
+            task->acct.nvcsw++;
+        }
+#endif
+        switch_to_fast(next->ctx);
+    }
+    /*
+     * 任务被重新调度后从这里继续执行
+     * 注意此时任务可能已经被迁移到其它hart，h不再可信
+     */
+    irq_restore(flags);
+
+    reap_zombie();
 }
 
 /*
@@ -65,125 +761,1202 @@ void sched_init(){
  * 作为系统调用的接口，调用任务放弃CPU，一个新任务开始运行
  */
 void task_yield(){
-    switch_to(&schedule_context);
+    schedule();
 }
 
 /*
- * 实现任务调度
+ * 将任务从其所在hart的就绪队列中取出，放入h的就绪队列，用于task_yield_to()
+ * 正在运行的任务，以及上下文尚未保存完毕的任务不能被迁移
+ * 调用者需关闭中断，且不能持有任何就绪队列的锁
+ * 返回值：
+ * 1：任务已经位于h的就绪队列中
+ * 0：任务无法迁移（不在就绪队列中或正在运行）
  */
-void schedule(){
-    /* 获取当前正在执行的任务 */ 
-    struct Task *task = now_task;
-    /* 指向当前任务数字里最高优先级的第一个任务 */
-    struct Task *first_task = NULL;
-    /* 获取第一个任务 */
-    for(int i = 0;i < Priority_num;i++){
-        if(task_priority_array[i].next != NULL){
-            first_task = task_priority_array[i].next;
-            break;
+static int pull_task(struct hart *h, struct Task *task){
+    struct hart *from = &harts[task->hart];
+    if(from == h){
+        return 1;
+    }
+    int pulled = 0;
+    spin_lock(&from->lock);
+    if(&harts[task->hart] == from && task->on_rq && task->state == TASK_READY
+       && task != from->now_task && *(volatile reg_t *)&task->ctx->running == 0){
+        rq_dequeue(from, task);
+        task->hart = h - harts;
+        pulled = 1;
+    }
+    spin_unlock(&from->lock);
+    if(pulled){
+        spin_lock(&h->lock);
+        rq_enqueue(h, task);
+        spin_unlock(&h->lock);
+    }
+    return pulled;
+}
+
+/*
+ * 描述：
+ * 让出CPU并直接切换到指定的任务，不经过按优先级的轮转选择
+ * 用于生产者/消费者等明确知道下一个该运行哪个任务的场合
+ * 公平性与task_yield()保持一致：当前任务同样轮转到其队列的队尾，
+ * 目标任务被移到其队列的队首运行，它让出CPU时同样轮转到队尾
+ * 目标任务位于其它hart的就绪队列且没有在运行时，先将其迁移到当前hart
+ * - task：task_create()返回的任务句柄，调用者需保证该任务尚未退出
+ * 返回值：
+ * 0：已经直接切换到目标任务（当前任务重新被调度后返回）
+ * -1：目标任务不可运行（阻塞、正在其它hart上运行或就是当前任务），
+ *     此时退化为task_yield()
+ */
+int task_yield_to(struct Task *task){
+    reg_t flags = irq_save();
+    struct hart *h = this_hart();
+    struct Task *self = h->now_task;
+
+    /* EDF任务按截止时间调度，不能插队，也不能在hart之间迁移 */
+    if(task == NULL || task == self || task->policy != SCHED_PRIO
+       || (task->group != NULL && task->group->throttled) || !pull_task(h, task)){
+        irq_restore(flags);
+        task_yield();
+        return -1;
+    }
+
+    spin_lock(&h->lock);
+    /* 迁移之后到加锁之前，目标任务可能已经被阻塞或被窃取 */
+    if(&harts[task->hart] != h || !task->on_rq || task->state != TASK_READY){
+        spin_unlock(&h->lock);
+        irq_restore(flags);
+        task_yield();
+        return -1;
+    }
+    update_curr(h);
+    rq_rotate_current(h);
+    /* 将目标任务移到其队列的队首，作为正在运行的任务 */
+    rq_dequeue(h, task);
+    rq_enqueue(h, task);
+    h->ready_queue[task->priority] = task;
+    h->now_priority = task->priority;
+    h->now_task = task;
+    task->ctx->running = 1;
+#if SCHED_ACCT
+    acct_switch(h, self, task);
+    self->acct.nvcsw++;
+#endif
+#if SCHED_LATENCY
+    lat_dispatch(h, task);
+#endif
+    task_switch_in(h, self, task);
+    spin_unlock(&h->lock);
+
+    h->switch_count++;
+    h->yield_to_count++;
+    switch_to_fast(task->ctx);
+
+    irq_restore(flags);
+    reap_zombie();
+    return 0;
+}
+
+/*
+ * hart 0空闲时需要产生定时器中断的时间片：
+ * 定时器轮中最早的到期时间与被节流的任务组最早的配额补充时间中较早者
+ * 返回值：
+ * 时间片计数，为0表示不需要定时器中断
+ */
+static uint64_t idle_deadline(){
+    uint64_t wheel = timer_wheel_next();
+    uint64_t refill = task_group_next_refill();
+    if(wheel == 0 || (refill != 0 && refill < wheel)){
+        return refill;
+    }
+    return wheel;
+}
+
+/*
+ * 空闲任务，每个hart一个，优先级最低且不在就绪队列中
+ * 没有任务可运行时执行wfi，并停止周期性的定时器中断（tickless）：
+ * hart 0只在定时器轮或任务组配额补充的最早期限到来时产生定时器中断，
+ * 其它hart不再产生定时器中断，由核间中断（sched_kick()）唤醒
+ * 在关闭中断的状态下检查就绪队列并执行wfi，
+ * wfi不受mstatus.MIE影响，检查之后到来的中断仍会唤醒hart，不会丢失
+ */
+static void idle_main(void *param){
+    while(1){
+        schedule();
+
+        reg_t flags = irq_save();
+        struct hart *h = this_hart();
+        if(h->wd_parked != NULL){
+            /* 被罚停的任务是本hart唯一的任务，不必等到下一个时间片 */
+            wd_unpark(h);
+        }else if(h->nr_ready == 0){
+            h->idle_count++;
+            timer_idle(h == &harts[0] ? idle_deadline() : 0);
+            asm volatile("wfi");
+            timer_idle_exit();
         }
+        /* 打开中断后处理唤醒hart的中断，之后再次尝试调度（包括从其它hart窃取任务） */
+        irq_restore(flags);
     }
-    /* 若无任务，则退出schedule */
-    if(first_task == NULL){
-        panic("No task to schedule!\n");
+}
+
+/*
+ * 描述：
+ * 每个hart完成初始化后进入调度，不再返回
+ * 启动时的上下文保存在schedule_context中，之后不会再被恢复
+ */
+void sched_start(){
+    schedule();
+    panic("sched_start: schedule_context resumed!");
+}
+
+/*
+ * 描述：
+ * 若hart正在运行空闲任务，向其发送核间中断，使其从wfi返回并重新调度
+ * 就绪队列或定时器轮被修改之后调用
+ * - hart：目标hart
+ */
+void sched_kick(int hart){
+    struct hart *h = &harts[hart];
+    if(hart == r_tp() || !h->online){
         return;
     }
-    /* 如果当前任务被删除或第一次调度，则调度搜索到的第一个任务 */
-    if(task == NULL){
-        now_task = first_task;
-        struct context *next = &now_task->ctx_tasks; 
-        switch_to(next);
-    }else{
-        /* 如果当前最高优先级和当前任务的优先级一样，在此任务链表中循环 */
-        if(first_task->priority == now_priority){
-            now_task = task->next;
-            struct context *next = &now_task->ctx_tasks;
-            switch_to(next);
+    if(*(struct Task * volatile *)&h->now_task == &h->idle_task){
+        *(volatile uint32_t*)CLINT_MSIP(hart) = 1;
+    }
+}
+
+/*
+ * 唤醒一个空闲的hart，让其从繁忙的hart窃取任务
+ * 就绪任务数达到可以被窃取的数量时调用
+ */
+static void sched_kick_idle(){
+    for(int id = 0;id < MAXNUM_CPU;id++){
+        struct hart *h = &harts[id];
+        if(id != r_tp() && h->online
+           && *(struct Task * volatile *)&h->now_task == &h->idle_task){
+            sched_kick(id);
+            return;
+        }
+    }
+}
+
+/* 将被看门狗罚停的任务放回就绪队列，调用者需关闭中断 */
+static void wd_unpark(struct hart *h){
+    struct Task *task = h->wd_parked;
+    h->wd_parked = NULL;
+    task_wakeup(task);
+}
+
+/*
+ * hart 0代为检查其它hart：任务占用CPU超过两倍上限仍未被该hart自己的看门狗记录，
+ * 说明该hart的定时器中断被屏蔽（任务关闭了中断），只能记录，无法采样mepc或处理
+ */
+static void watchdog_remote(uint64_t now){
+    for(int id = 1;id < MAXNUM_CPU;id++){
+        struct hart *h = &harts[id];
+        struct Task *task = h->now_task;
+        uint64_t start = h->dispatch_time;
+        if(!h->online || task == NULL || task == &h->idle_task || h->wd_fired
+           || start == h->wd_remote_stamp || now - start < 2 * watchdog_limit){
+            continue;
+        }
+        h->wd_remote_stamp = start;
+        watchdog_fire(task, id, now - start, 0, 1);
+    }
+}
+
+/*
+ * 看门狗：在定时器中断中检查当前任务连续占用CPU的时间，
+ * 超过watchdog_limit时记录任务与被打断处的mepc，并按照设定的方式处理：
+ * WD_RESCHED：将任务移出就绪队列一个时间片，让其它就绪的任务（包括更低优先级的）运行
+ * WD_KILL：将被打断处的返回地址改为task_exit，任务下次运行时退出，
+ *          任务持有的互斥锁不会被释放
+ * 空闲任务不受检查，调用者需关闭中断
+ * 返回值：
+ * 当前任务的返回地址
+ */
+static reg_t watchdog_tick(struct hart *h, struct Task *task, reg_t epc){
+    uint64_t now = timer_get_mtime();
+    if(h == &harts[0]){
+        watchdog_remote(now);
+    }
+    if(task == &h->idle_task || h->wd_fired || now - h->dispatch_time < watchdog_limit){
+        return epc;
+    }
+    h->wd_fired = 1;
+    int action = watchdog_fire(task, h - harts, now - h->dispatch_time, epc, 0);
+    if(action == WD_KILL){
+        return task_fault_exit();
+    }
+    if(action == WD_RESCHED && h->nr_ready > 1 && h->wd_parked == NULL){
+        spin_lock(&h->lock);
+        if(task->on_rq && task->state == TASK_READY){
+            rq_dequeue(h, task);
+            task->state = TASK_BLOCKED;
+            h->wd_parked = task;
+        }
+        spin_unlock(&h->lock);
+    }
+    return epc;
+}
+
+/*
+ * 描述：
+ * 时间片到期时由定时器中断调用（此时中断关闭）
+ * 当前任务的上下文已经由trap入口保存在mscratch指向的位置，
+ * 若需要抢占，只需将mscratch指向新任务的上下文，
+ * 中断返回时便会恢复新任务，并清除被抢占任务的running标志。
+ * 只有当CPU正在执行某个任务时才进行抢占，
+ * 内核启动阶段或任务正在切换时直接返回。
+ * 同时检查各hart之间的负载，必要时从繁忙的hart窃取任务
+ * - epc：被打断处的地址
+ * 返回值：
+ * 被打断的任务的返回地址，看门狗终止任务时为task_exit
+ */
+reg_t schedule_tick(reg_t epc){
+    struct hart *h = this_hart();
+    struct Task *task = h->now_task;
+    if(task == NULL || r_mscratch() != (reg_t)task->ctx){
+        return epc;
+    }
+    if(task != &h->idle_task){
+        h->quantum_expire_count++;
+    }
+    /* 罚停的任务已经让出了一个时间片 */
+    if(h->wd_parked != NULL && h->wd_parked != task){
+        wd_unpark(h);
+    }
+    if(watchdog_limit != 0){
+        epc = watchdog_tick(h, task, epc);
+    }
+
+    steal_task(h);
+
+    spin_lock(&h->lock);
+    struct Task *next = pick_next_task(h);
+    spin_unlock(&h->lock);
+    if(next != task){
+        h->switch_count++;
+        h->preempt_count++;
+#if SCHED_ACCT
+        task->acct.nivcsw++;
+#endif
+        w_mscratch((reg_t)next->ctx);
+    }
+    return epc;
+}
+
+/*
+ * 描述：
+ * 由trap返回路径（entry.S）在本hart的sched_need_resched被置位时调用，此时中断关闭
+ * 中断处理函数唤醒了应当抢占当前任务的任务时，在返回之前切换过去，
+ * 中断到任务运行的延迟只取决于trap路径，不必等到当前任务让出CPU或时间片到期。
+ * 与schedule_tick()相同，只需将mscratch指向新任务的上下文；
+ * 被抢占的任务没有用完时间片，不轮转到队尾。
+ * 内核启动阶段或任务正在切换时直接返回，请求留给之后的调度
+ */
+void sched_irq_exit(){
+    struct hart *h = this_hart();
+    sched_need_resched[h - harts] = 0;
+    struct Task *task = h->now_task;
+    if(task == NULL || r_mscratch() != (reg_t)task->ctx){
+        return;
+    }
+    spin_lock(&h->lock);
+    struct Task *next = __pick_next_task(h, 0);
+    spin_unlock(&h->lock);
+    if(next != task){
+        h->switch_count++;
+        h->irq_preempt_count++;
+#if SCHED_ACCT
+        task->acct.nivcsw++;
+#endif
+        w_mscratch((reg_t)next->ctx);
+    }
+}
+
+/* 打印调度统计信息，用于调整时间片长度 */
+void sched_stat(){
+    for(int id = 0;id < MAXNUM_CPU;id++){
+        struct hart *h = &harts[id];
+        if(!h->online){
+            continue;
+        }
+        printf("hart %d: tasks: %d, switch: %ld, quantum expire: %ld, preempt: %ld, irq preempt: %ld, steal: %ld, idle: %ld, yield_to: %ld\n",
+               id, h->nr_ready, h->switch_count, h->quantum_expire_count,
+               h->preempt_count, h->irq_preempt_count, h->steal_count, h->idle_count, h->yield_to_count);
+        printf("hart %d: edf tasks: %d, edf util: %ld/%d, deadline miss: %ld\n",
+               id, h->edf_count, h->edf_rq.util, EDF_UTIL_SCALE, h->edf_miss_count);
+    }
+}
+
+#if SCHED_ACCT
+/* task_top()最多显示的任务数 */
+#define TOP_MAX_TASKS 32
+
+/* task_top()在持有task_list_lock时复制的统计快照，打印时不再持有锁 */
+struct top_entry {
+    uint32_t tid;
+    uint8_t  hart;
+    uint8_t  policy;
+    uint8_t  state;
+    reg_t    entry;
+    uint64_t cycles;
+    uint64_t instret;
+    uint64_t run_time;
+    uint64_t ready_time;
+    uint64_t nvcsw;
+    uint64_t nivcsw;
+    uint64_t create_time;
+};
+
+/* 快照缓冲区较大，不放在任务栈上，由top_mutex保护 */
+static struct top_entry top_buf[TOP_MAX_TASKS];
+
+static const char *policy_name[] = {"prio", "edf", "fair"};
+
+/*
+ * 描述：
+ * 按照运行时间从多到少打印各任务的CPU时间统计
+ * run%：创建以来运行时间所占的比例
+ * 时间的单位为微秒，vcsw/ivcsw为主动让出与被抢占的次数
+ */
+void task_top(){
+    mutex_lock(&top_mutex);
+    int n = 0;
+    int total = 0;
+    uint64_t now = timer_get_mtime();
+
+    reg_t flags = irq_save();
+    spin_lock(&task_list_lock);
+    for(struct Task *t = task_list;t != NULL;t = t->list_next){
+        total++;
+        if(n == TOP_MAX_TASKS){
+            continue;
+        }
+        struct top_entry *e = &top_buf[n++];
+        e->tid = t->tid;
+        e->hart = t->hart;
+        e->policy = t->policy;
+        e->state = t->state;
+        e->entry = (reg_t)t->entry;
+        e->cycles = t->acct.cycles;
+        e->instret = t->acct.instret;
+        e->run_time = t->acct.run_time;
+        e->ready_time = t->acct.ready_time;
+        e->nvcsw = t->acct.nvcsw;
+        e->nivcsw = t->acct.nivcsw;
+        e->create_time = t->acct.create_time;
+    }
+    spin_unlock(&task_list_lock);
+    irq_restore(flags);
+
+    /* 对下标进行插入排序，任务数很少 */
+    uint8_t order[TOP_MAX_TASKS];
+    for(int i = 0;i < n;i++){
+        int j = i - 1;
+        while(j >= 0 && top_buf[order[j]].run_time < top_buf[i].run_time){
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = i;
+    }
+
+    printf("tasks: %d\n", total);
+    printf("  tid hart policy state            entry run%%      cycles     instret      run(us)    ready(us)     vcsw    ivcsw\n");
+    for(int i = 0;i < n;i++){
+        struct top_entry *e = &top_buf[order[i]];
+        uint64_t life = now - e->create_time;
+        printf("%5d %4d %6s %5s %16lx %3ld%% %11ld %11ld %12ld %12ld %8ld %8ld\n",
+               e->tid, e->hart, policy_name[e->policy],
+               e->state == TASK_READY ? "ready" : "block", e->entry,
+               life ? e->run_time * 100 / life : 0, e->cycles, e->instret,
+               timer_cycles_to_us(e->run_time), timer_cycles_to_us(e->ready_time),
+               e->nvcsw, e->nivcsw);
+    }
+    if(total > n){
+        printf("... %d more\n", total - n);
+    }
+    mutex_unlock(&top_mutex);
+}
+#else
+void task_top(){
+    printf("task_top: SCHED_ACCT is disabled\n");
+}
+#endif
+
+/* stack_stat()最多显示的任务数 */
+#define STACK_STAT_MAX 32
+
+struct stack_entry {
+    uint32_t tid;
+    uint32_t size;
+    uint32_t used;
+};
+
+/* stack_stat()在持有task_list_lock时统计的快照，由stack_mutex保护 */
+static struct stack_entry stack_buf[STACK_STAT_MAX];
+
+/*
+ * 描述：
+ * 打印各任务与各hart空闲任务的栈大小与最大使用量（字节），
+ * 可据此为任务选择更小的栈
+ */
+void stack_stat(){
+    mutex_lock(&stack_mutex);
+    int n = 0;
+    int total = 0;
+
+    reg_t flags = irq_save();
+    spin_lock(&task_list_lock);
+    for(struct Task *t = task_list;t != NULL;t = t->list_next){
+        total++;
+        if(n == STACK_STAT_MAX){
+            continue;
+        }
+        struct stack_entry *e = &stack_buf[n++];
+        e->tid = t->tid;
+        e->size = t->stack_size;
+        e->used = stack_used(t);
+    }
+    spin_unlock(&task_list_lock);
+    irq_restore(flags);
+
+    printf("  tid   size   used  used%%\n");
+    for(int i = 0;i < n;i++){
+        struct stack_entry *e = &stack_buf[i];
+        printf("%5d %6d %6d %5d%%\n", e->tid, e->size, e->used, e->used * 100 / e->size);
+    }
+    if(total > n){
+        printf("... %d more\n", total - n);
+    }
+    for(int id = 0;id < MAXNUM_CPU;id++){
+        struct Task *idle = &harts[id].idle_task;
+        if(harts[id].online){
+            uint32_t used = stack_used(idle);
+            printf("idle%d %6d %6d %5d%%\n", id, idle->stack_size, used, used * 100 / idle->stack_size);
+        }
+    }
+    mutex_unlock(&stack_mutex);
+}
+
+/*
+ * 任务加入h的就绪队列后调用：唤醒空闲的h，
+ * h上有可被窃取的任务时再唤醒一个空闲的hart
+ */
+static void sched_wake_hart(struct hart *h){
+    sched_kick(h - harts);
+    if(h->nr_ready >= 2){
+        sched_kick_idle();
+    }
+}
+
+/*
+ * 判断被唤醒的任务是否应当抢占h正在运行的任务，调用者需持有h->lock
+ * EDF任务抢占非EDF任务与截止时间更晚的EDF任务，
+ * 固定优先级任务抢占公平调度任务与优先级更低的固定优先级任务，
+ * 公平调度任务只在时间片到期时竞争CPU；空闲任务总是被抢占
+ */
+static int wakeup_preempt(struct hart *h, struct Task *task){
+    struct Task *curr = h->now_task;
+    if(curr == NULL){
+        return 0;
+    }
+    if(curr == &h->idle_task){
+        return 1;
+    }
+    if(task->policy == SCHED_EDF){
+        return curr->policy != SCHED_EDF || task->edf.deadline < curr->edf.deadline;
+    }
+    if(task->policy == SCHED_PRIO){
+        return curr->policy == SCHED_FAIR
+               || (curr->policy == SCHED_PRIO && task->priority < curr->priority);
+    }
+    return 0;
+}
+
+/*
+ * 请求h重新调度：置位sched_need_resched，
+ * h是其它hart时发送核间中断，由核间中断的返回路径完成抢占
+ */
+static void sched_resched(struct hart *h){
+    int id = h - harts;
+    sched_need_resched[id] = 1;
+    if(id != r_tp() && h->online){
+        *(volatile uint32_t*)CLINT_MSIP(id) = 1;
+    }
+}
+
+/* 返回就绪任务最少的在线hart，新任务放在这里 */
+static struct hart *least_loaded_hart(){
+    struct hart *best = &harts[0];
+    for(int id = 1;id < MAXNUM_CPU;id++){
+        struct hart *h = &harts[id];
+        if(h->online && h->nr_ready < best->nr_ready){
+            best = h;
+        }
+    }
+    return best;
+}
+
+/* 返回当前正在运行的任务 */
+struct Task *task_self(){
+    reg_t flags = irq_save();
+    struct Task *task = this_hart()->now_task;
+    irq_restore(flags);
+    return task;
+}
+
+/*
+ * 描述：
+ * 准备阻塞当前任务：将状态设为TASK_BLOCKED，此时任务仍在就绪队列中
+ * 必须在把任务挂入等待结构（定时器轮、等待队列等）之前调用，
+ * 这样在task_block()之前到来的唤醒不会丢失：
+ * task_wakeup()会把状态改回TASK_READY，task_block()看到后直接返回
+ * 调用者需关闭中断
+ */
+void task_prepare_block(){
+    struct hart *h = this_hart();
+    spin_lock(&h->lock);
+    h->now_task->state = TASK_BLOCKED;
+    spin_unlock(&h->lock);
+}
+
+/*
+ * 描述：
+ * 阻塞当前任务：将其从就绪队列中移除并切换到其它任务，直到被task_wakeup()唤醒
+ * - lk：任务挂入等待结构时持有的锁，在任务离开就绪队列后才释放，可以为NULL
+ * 调用者需关闭中断并已调用task_prepare_block()，
+ * 任务被唤醒后从这里返回，中断仍然关闭
+ */
+void task_block(struct spinlock *lk){
+    struct hart *h = this_hart();
+    struct Task *task = h->now_task;
+
+    spin_lock(&h->lock);
+    /* 在task_prepare_block()之后已经被唤醒 */
+    if(task->state != TASK_BLOCKED){
+        spin_unlock(&h->lock);
+        if(lk != NULL){
+            spin_unlock(lk);
+        }
+        return;
+    }
+    update_curr(h);
+    rq_dequeue(h, task);
+    h->now_task = NULL;
+    spin_unlock(&h->lock);
+    if(lk != NULL){
+        spin_unlock(lk);
+    }
+
+    /*
+     * 释放锁后任务可能已经被唤醒并重新放回本hart的就绪队列，
+     * 此时可能再次选中自己，不需要切换
+     */
+    struct Task *next = find_next_task(h);
+    if(next != task){
+        h->switch_count++;
+#if SCHED_ACCT
+        task->acct.nvcsw++;
+#endif
+        switch_to_fast(next->ctx);
+    }
+}
+
+/*
+ * 描述：
+ * 唤醒处于阻塞状态的任务，放回其所在hart的就绪队列的队尾
+ * 任务没有处于阻塞状态时什么也不做，因此重复唤醒是安全的
+ * 放回原来的hart而不是当前hart：任务阻塞时的上下文保存由原来的hart完成，
+ * 原来的hart在保存完成之前不会再次调度就绪队列
+ * 可以在中断处理函数中调用：任务应当抢占该hart正在运行的任务时请求重新调度，
+ * 在中断处理函数中唤醒时，中断返回时就会切换到它（见sched_irq_exit()）
+ */
+void task_wakeup(struct Task *task){
+    reg_t flags = irq_save();
+    struct hart *h = &harts[task->hart];
+    int queued = 0;
+    int preempt = 0;
+    spin_lock(&h->lock);
+    if(task->state == TASK_BLOCKED){
+        task->state = TASK_READY;
+        if(task->policy == SCHED_EDF && task->edf.next_release != 0){
+            edf_start_job(h, task, task->edf.next_release);
+            task->edf.next_release = 0;
+        }
+        /* 任务还没有离开就绪队列（task_block()尚未执行）时不需要入队 */
+        if(!task->on_rq){
+#if SCHED_ACCT
+            task->acct.ready_since = timer_get_mtime();
+#endif
+#if SCHED_LATENCY
+            task->wake_time = timer_get_mtime();
+#endif
+            rq_enqueue(h, task);
+            queued = 1;
+            preempt = wakeup_preempt(h, task);
+        }
+    }
+    spin_unlock(&h->lock);
+    if(preempt){
+        sched_resched(h);
+    }
+    if(queued){
+        sched_wake_hart(h);
+    }
+    irq_restore(flags);
+}
+
+/*
+ * 描述：
+ * 修改任务的当前优先级，用于互斥锁的优先级继承，base_priority保持不变
+ * 任务在就绪队列中时移动到新优先级的队列：
+ * 正在运行的任务放在队首，保持“正在运行的任务位于队首”的约定，
+ * 其它任务放在队尾
+ * 任务可能正在被其它hart窃取，加锁后需要确认task->hart没有变化
+ * - task：要修改的任务
+ * - priority：新的优先级
+ */
+void task_set_priority(struct Task *task, uint8_t priority){
+    reg_t flags = irq_save();
+    struct hart *h;
+    while(1){
+        h = &harts[task->hart];
+        spin_lock(&h->lock);
+        if(h == &harts[task->hart]){
+            break;
+        }
+        spin_unlock(&h->lock);
+    }
+    /*
+     * EDF与公平调度的任务不按优先级排队，只记录优先级，供等待队列排序使用，
+     * 因此优先级继承只对SCHED_PRIO的持有者生效
+     */
+    if(task->priority != priority){
+        if(task->on_rq && task->policy == SCHED_PRIO){
+            rq_dequeue(h, task);
+            task->priority = priority;
+            rq_enqueue(h, task);
+            if(h->now_task == task){
+                h->ready_queue[priority] = task;
+                h->now_priority = priority;
+            }
         }else{
-            /* 否则执行当前最高优先级的任务队列 */
-            now_task = first_task;
-            struct context *next = &now_task->ctx_tasks; 
-            switch_to(next);
+            task->priority = priority;
+        }
+    }
+    spin_unlock(&h->lock);
+    irq_restore(flags);
+}
+
+/*
+ * 分配任务与它的栈并初始化上下文，失败时返回NULL
+ * 新任务默认为SCHED_PRIO，尚未加入任何就绪队列
+ * - stack_size：栈的大小，为0时使用STACK_SIZE，小于STACK_MIN时使用STACK_MIN
+ * - user：为1时在保护区之下分配内核栈（见KSTACK_SIZE），
+ *   内存布局为 内核栈 | 保护区 | 栈 | 上下文，内核栈与保护区按KSTACK_SIZE对齐
+ */
+static struct Task *task_alloc(void (*task)(void* param),void* param,uint8_t priority,uint32_t stack_size,int user){
+    reap_zombie();
+    if(stack_size == 0){
+        stack_size = STACK_SIZE;
+    }else if(stack_size < STACK_MIN){
+        stack_size = STACK_MIN;
+    }
+    stack_size = (stack_size + 15) & ~15;
+    struct Task *new_task = tcb_alloc();
+    if(new_task == NULL){
+        return NULL;
+    }
+    /* 保护区（用户模式的任务为内核栈与保护区）之下的区域需要对齐到它的大小，为此多分配region字节 */
+    reg_t region = user ? KSTACK_SIZE : STACK_GUARD;
+    void *mem = malloc(region + region - STACK_GUARD + STACK_MEM_SIZE(stack_size));
+    if(mem == NULL){
+        tcb_free(new_task);
+        return NULL;
+    }
+    new_task->stack_mem = mem;
+    uint8_t *base = (uint8_t *)(((reg_t)mem + region - 1) & ~(region - 1));
+    stack_setup(new_task, base + region - STACK_GUARD, stack_size);
+    new_task->ctx->kstack = 0;
+    if(user){
+        uint64_t *p = (uint64_t *)base;
+        for(uint32_t i = 0;i < (KSTACK_SIZE - STACK_GUARD) / 8;i++){
+            p[i] = STACK_FILL;
         }
-    }    
+        new_task->ctx->kstack = (reg_t)(new_task->stack_base - STACK_GUARD);
+    }
+    new_task->ctx->ra = (reg_t) task_exit;
+    new_task->ctx->pc = (reg_t) task;
+    new_task->ctx->a0 = (reg_t) param;
+    /* 新任务需要通过a0传入参数，必须按完整上下文恢复 */
+    new_task->ctx->flag = CTX_FULL;
+    new_task->ctx->running = 0;
+    new_task->ctx->mpp = MSTATUS_MPP;
+    new_task->priority = priority;
+    new_task->base_priority = priority;
+    new_task->state = TASK_READY;
+    new_task->policy = SCHED_PRIO;
+    new_task->on_rq = 0;
+    new_task->fair.vruntime = 0;
+    new_task->fair.weight = FAIR_WEIGHT_0;
+    new_task->fair.left = NULL;
+    new_task->fair.right = NULL;
+    new_task->front = NULL;
+    new_task->next = NULL;
+    new_task->expire_tick = 0;
+    new_task->timer_next = NULL;
+    new_task->timer_front = NULL;
+    new_task->wait_next = NULL;
+    new_task->wait_on = NULL;
+    new_task->wait_data = NULL;
+    new_task->held_mutex = NULL;
+    new_task->notify_value = 0;
+    new_task->notify_pending = 0;
+    new_task->notify_waiting = 0;
+    spin_init(&new_task->notify_lock);
+    new_task->group = NULL;
+    new_task->throttle_next = NULL;
+    new_task->tid = __sync_fetch_and_add(&next_tid, 1);
+    new_task->entry = task;
+#if SCHED_ACCT
+    new_task->acct.cycles = 0;
+    new_task->acct.instret = 0;
+    new_task->acct.run_time = 0;
+    new_task->acct.ready_time = 0;
+    new_task->acct.nvcsw = 0;
+    new_task->acct.nivcsw = 0;
+    new_task->acct.create_time = 0;
+    new_task->acct.ready_since = 0;
+#endif
+#if SCHED_LATENCY
+    new_task->wake_time = 0;
+#endif
+    return new_task;
+}
+
+/*
+ * 将新任务加入任务链表与h的就绪队列，调用者需关闭中断
+ */
+static void task_activate(struct hart *h, struct Task *task){
+    spin_lock(&task_list_lock);
+    task->list_next = task_list;
+    task->list_front = NULL;
+    if(task_list != NULL){
+        task_list->list_front = task;
+    }
+    task_list = task;
+    spin_unlock(&task_list_lock);
+
+    spin_lock(&h->lock);
+#if SCHED_ACCT
+    task->acct.create_time = timer_get_mtime();
+    task->acct.ready_since = task->acct.create_time;
+#endif
+#if SCHED_LATENCY
+    task->wake_time = timer_get_mtime();
+#endif
+    rq_enqueue(h, task);
+    spin_unlock(&h->lock);
+    sched_wake_hart(h);
+
+    __sync_fetch_and_add(&task_num, 1);
+}
+
+/* 将退出的任务从任务链表中移除，调用者需关闭中断 */
+static void task_deactivate(struct Task *task){
+    spin_lock(&task_list_lock);
+    if(task->list_front == NULL){
+        task_list = task->list_next;
+    }else{
+        task->list_front->list_next = task->list_next;
+    }
+    if(task->list_next != NULL){
+        task->list_next->list_front = task->list_front;
+    }
+    spin_unlock(&task_list_lock);
 }
 
 /* 
  * 描述：
- * 创建一个任务
+ * 创建一个任务，插入就绪任务最少的hart对应优先级就绪队列的队尾
  * - task：任务例程进入点
+ * - stack_size：栈的大小（字节），为0时使用STACK_SIZE，
+ *   可根据stack_stat()统计的最大使用量调小，中断处理同样使用任务的栈，需留有余量
  * 返回值：
- * 0：创建成功
- * -1：有错误发生
+ * 任务句柄，可用于task_yield_to()，任务退出后句柄失效
+ * NULL：有错误发生
  */
-int task_create(void (*task)(void* param),void* param,uint8_t priority){
+struct Task *task_create(void (*task)(void* param),void* param,uint8_t priority,uint32_t stack_size){
     /* 首先保证任务的优先级不高于或等于当前系统的优先级数量 */
-    if(priority < Priority_num){
-        /* 如果当前优先级的链表为空，则创建该优先级的第一个任务 */
-        if(task_priority_array[priority].next == NULL){
-            struct Task *new_task = (struct Task*)malloc(sizeof(struct Task));
-            new_task->ctx_tasks.sp = (reg_t) &new_task->task_stack[STACK_SIZE-8];
-            new_task->ctx_tasks.ra = (reg_t) task;
-            new_task->ctx_tasks.a0 = (reg_t) param;
-            new_task->priority = priority;
-            new_task->next = new_task;
-            new_task->front = new_task;
-            task_priority_array[priority].next = new_task;
-            task_num++;
-        }else{
-            struct Task *first_task = task_priority_array[priority].next;
-            struct Task *new_task = (struct Task*)malloc(sizeof(struct Task));
-            new_task->ctx_tasks.sp = (reg_t) &new_task->task_stack[STACK_SIZE-8];
-            new_task->ctx_tasks.ra = (reg_t) task;
-            new_task->ctx_tasks.a0 = (reg_t) param;
-            new_task->priority = priority;
-            new_task->front = first_task->front;
-            first_task->front->next = new_task;
-            new_task->next = first_task;
-            first_task->front = new_task;
-            task_priority_array[priority].next = new_task;
-            task_num++;
+    if(priority >= Priority_num){
+        return NULL;
+    }
+    struct Task *new_task = task_alloc(task, param, priority, stack_size, 0);
+    if(new_task == NULL){
+        return NULL;
+    }
+
+    /* 就绪队列与定时器中断以及其它hart共享，操作时关闭中断并加锁 */
+    reg_t flags = irq_save();
+    task_activate(least_loaded_hart(), new_task);
+    irq_restore(flags);
+    return new_task;
+}
+
+/*
+ * 描述：
+ * 创建一个在用户模式下运行的任务，其余与task_create()相同
+ * 任务可以执行内核的代码段、读取只读数据段、读写堆（QEMU上由PMP限定，见user_pmp_init()），
+ * 不能访问内核的.data/.bss、机器模式的栈与外设，通过syscall.h中的系统调用使用内核服务，
+ * 系统调用检查传入的缓冲区是否位于上述范围内（见user_access_ok()），
+ * 进入内核时切换到保护区之下的内核栈（见KSTACK_SIZE），不使用任务自己的sp，
+ * 任务的参数与要和其它任务共享的数据需要放在堆中
+ * 例程返回时经usys_exit()以SYS_exit退出；发生异常时任务被终止，不影响内核
+ * 任务例程中不能直接调用访问外设、CSR或内核全局变量的内核函数
+ * 限制：堆由所有任务与内核共用，PMP与系统调用的检查不能阻止用户模式的任务
+ * 读写堆中其它任务的栈、任务控制块等内核对象，或者释放不属于它的内存块，
+ * 只适合运行可信但需要与外设隔离的代码；K210没有PMP，用户模式的任务不受任何限制
+ * 返回值：
+ * 任务句柄
+ * NULL：有错误发生
+ */
+struct Task *task_create_user(void (*task)(void* param),void* param,uint8_t priority,uint32_t stack_size){
+    if(priority >= Priority_num){
+        return NULL;
+    }
+    struct Task *new_task = task_alloc(task, param, priority, stack_size, 1);
+    if(new_task == NULL){
+        return NULL;
+    }
+    new_task->ctx->ra = (reg_t) usys_exit;
+    new_task->ctx->mpp = 0;
+
+    reg_t flags = irq_save();
+    task_activate(least_loaded_hart(), new_task);
+    irq_restore(flags);
+    return new_task;
+}
+
+/*
+ * 描述：
+ * 创建一个周期性的EDF实时任务，第一个作业立即释放
+ * 任务每完成一个作业调用task_wait_next_period()等待下一个周期
+ * EDF任务优先于所有固定优先级任务，按照绝对截止时间最早优先调度，
+ * 固定在创建时选定的hart上运行，不会被其它hart窃取
+ * 准入控制：各hart上EDF任务的利用率 budget/min(deadline,period) 之和
+ * 不能超过EDF_UTIL_MAX，选择能够容纳该任务且利用率最低的在线hart
+ * 作业的释放由定时器轮完成，释放时间向上对齐到时间片边界，
+ * 因此周期与相对截止时间不能小于当前的时间片长度（见timer_set_quantum()）
+ * - period_us：周期，微秒
+ * - budget_us：每个周期的执行预算，微秒，超出预算时截止时间被推迟一个周期
+ * - deadline_us：相对截止时间，微秒，为0时等于周期
+ * 返回值：
+ * 任务句柄
+ * NULL：参数错误、无法通过准入控制或内存不足
+ */
+struct Task *task_create_edf(void (*task)(void* param),void* param,
+                             uint64_t period_us,uint64_t budget_us,uint64_t deadline_us){
+    if(deadline_us == 0){
+        deadline_us = period_us;
+    }
+    if(budget_us == 0 || budget_us > deadline_us || deadline_us > period_us){
+        return NULL;
+    }
+    uint64_t period = timer_us_to_cycles(period_us);
+    uint64_t budget = timer_us_to_cycles(budget_us);
+    uint64_t deadline = timer_us_to_cycles(deadline_us);
+    /* 短于一个时间片的周期无法由定时器轮按时释放，截止时间也无法保证；deadline不大于period，只需检查deadline */
+    if(budget == 0 || deadline < timer_get_quantum()){
+        return NULL;
+    }
+    uint64_t util = budget * EDF_UTIL_SCALE / deadline;
+
+    struct Task *new_task = task_alloc(task, param, 0, STACK_SIZE, 0);
+    if(new_task == NULL){
+        return NULL;
+    }
+    new_task->policy = SCHED_EDF;
+    new_task->edf.period = period;
+    new_task->edf.rel_deadline = deadline;
+    new_task->edf.budget = budget;
+    new_task->edf.util = util;
+    new_task->edf.miss_count = 0;
+    new_task->edf.overrun_count = 0;
+    new_task->edf.heap_index = -1;
+
+    reg_t flags = irq_save();
+    spin_lock(&edf_admit_lock);
+    struct hart *h = NULL;
+    for(int id = 0;id < MAXNUM_CPU;id++){
+        struct hart *other = &harts[id];
+        if(other->online && other->edf_count < EDF_MAX_TASKS
+           && other->edf_rq.util + util <= EDF_UTIL_MAX
+           && (h == NULL || other->edf_rq.util < h->edf_rq.util)){
+            h = other;
         }
-        return 0;
-    }else{
+    }
+    if(h == NULL){
+        spin_unlock(&edf_admit_lock);
+        irq_restore(flags);
+        task_free(new_task);
+        return NULL;
+    }
+    h->edf_rq.util += util;
+    h->edf_count++;
+    spin_unlock(&edf_admit_lock);
+
+    uint64_t now = timer_get_mtime();
+    new_task->edf.release = now;
+    new_task->edf.next_release = 0;
+    new_task->edf.job_deadline = now + deadline;
+    new_task->edf.deadline = now + deadline;
+    new_task->edf.budget_left = budget;
+    task_activate(h, new_task);
+    irq_restore(flags);
+    return new_task;
+}
+
+/*
+ * 描述：
+ * 创建一个公平调度的任务，插入就绪任务最少的hart
+ * 公平调度的任务只在没有就绪的EDF与固定优先级任务时运行，
+ * 它们之间按照权重分享CPU：每次选择虚拟运行时间最小的任务，
+ * 虚拟运行时间按照实际运行的mcycle周期数除以权重增长
+ * - nice：-20到19，越小权重越大，相差1时CPU份额约相差1.25倍
+ * 返回值：
+ * 任务句柄
+ * NULL：内存不足
+ */
+struct Task *task_create_fair(void (*task)(void* param),void* param,int nice){
+    /* 优先级只用于等待队列的排序与优先级继承，取最低 */
+    struct Task *new_task = task_alloc(task, param, Priority_num - 1, STACK_SIZE, 0);
+    if(new_task == NULL){
+        return NULL;
+    }
+    new_task->policy = SCHED_FAIR;
+    new_task->fair.weight = fair_weight(nice);
+
+    reg_t flags = irq_save();
+    task_activate(least_loaded_hart(), new_task);
+    irq_restore(flags);
+    return new_task;
+}
+
+/* 加锁后开始EDF任务的一个新作业，见edf_start_job() */
+static void edf_new_job(struct Task *task, uint64_t release){
+    reg_t flags = irq_save();
+    struct hart *h = &harts[task->hart];
+    spin_lock(&h->lock);
+    edf_start_job(h, task, release);
+    spin_unlock(&h->lock);
+    irq_restore(flags);
+}
+
+/*
+ * 描述：
+ * EDF任务完成当前作业，阻塞到下一个周期释放新的作业
+ * 作业完成时已经超过其截止时间则记为一次错过截止时间；
+ * 若下一个周期的释放时间已经过去（作业严重超时），跳过错过的周期，立即释放
+ * 返回值：
+ * 0：新的作业已经释放
+ * -1：当前任务不是EDF任务
+ */
+int task_wait_next_period(){
+    reg_t flags = irq_save();
+    struct hart *h = this_hart();
+    struct Task *task = h->now_task;
+    if(task->policy != SCHED_EDF){
+        irq_restore(flags);
         return -1;
     }
+    uint64_t now = timer_get_mtime();
+    if(now > task->edf.job_deadline){
+        task->edf.miss_count++;
+        h->edf_miss_count++;
+    }
+    uint64_t release = task->edf.release + task->edf.period;
+    if(release <= now){
+        release += (now - release) / task->edf.period * task->edf.period;
+        edf_new_job(task, release);
+        irq_restore(flags);
+        /* 新作业的截止时间更晚，让截止时间更早的任务先运行 */
+        schedule();
+        return 0;
+    }
+    /* 新作业由定时器到期时的task_wakeup()在入队之前开始，入队与抢占检查都使用新的截止时间 */
+    task->edf.next_release = release;
+    task_prepare_block();
+    timer_wheel_add(task, timer_mtime_to_tick(release));
+    task_block(NULL);
+    irq_restore(flags);
+    return 0;
 }
 
-/* 提供函数退出接口 */
+/*
+ * 提供函数退出接口
+ * 退出的任务成为zombie_task，直接切换到下一个任务，不再返回
+ */
 void task_exit(){
-    switch_to(&exit_context);
+    /* 先回收上一个退出的任务，保证最多只有一个未回收的任务 */
+    reap_zombie();
+
+    irq_save();
+    struct hart *h = this_hart();
+    struct Task *task = h->now_task;
+    if(task->policy == SCHED_EDF){
+        spin_lock(&edf_admit_lock);
+        h->edf_rq.util -= task->edf.util;
+        h->edf_count--;
+        spin_unlock(&edf_admit_lock);
+    }
+    task_deactivate(task);
+    spin_lock(&h->lock);
+    rq_dequeue(h, task);
+    h->now_task = NULL;
+    spin_unlock(&h->lock);
+    h->zombie_task = task;
+    __sync_fetch_and_sub(&task_num, 1);
+
+    struct Task *next = find_next_task(h);
+    h->switch_count++;
+    /* mscratch为0时switch_to不保存当前上下文，退出的任务无需保存 */
+    w_mscratch(0);
+    switch_to_fast(next->ctx);
 }
 
-void exit(){
-    struct Task *task = now_task;
-    /* 如果当前链表上只有一个任务，直接清空当前优先级，同时返回 */
-    if(task->next == task){
-        task_priority_array[task->priority].next = NULL;
-        free(task);
-        now_task = NULL;
-        task_num--;
-        switch_to(&schedule_context);
-        return;
+/*
+ * 由trap处理函数在需要终止当前任务时调用（中断关闭）
+ * 用户模式的任务需要回到机器模式才能执行task_exit()
+ * 返回值：
+ * trap返回地址，即task_exit
+ */
+reg_t task_fault_exit(){
+    struct context *ctx = this_hart()->now_task->ctx;
+    ctx->mpp = MSTATUS_MPP;
+    /* 用户模式的任务的sp不可信（可能已经越过保护区），在内核栈上执行task_exit() */
+    if(ctx->kstack != 0){
+        ctx->sp = ctx->kstack;
     }
-    /* 如果该任务是当前优先级的进入节点，则切换当前优先级进入节点 */
-    if(task_priority_array[task->priority].next == task){
-        task_priority_array[task->priority].next = task->next;
+    return (reg_t)task_exit;
+}
+
+/*
+ * 上下文切换性能测试
+ * 在当前上下文与一个只会切换回来的伙伴上下文之间来回切换，
+ * 分别统计switch_to（保存全部寄存器）与switch_to_fast（仅保存callee-saved寄存器）
+ * 每次切换平均消耗的mcycle周期数
+ */
+#define BENCH_ROUNDS 1000
+static struct context bench_context;
+static struct context *bench_back;
+static uint8_t bench_stack[1024];
+static void (*bench_switch)(struct context *next);
+
+static void bench_partner(){
+    while(1){
+        bench_switch(bench_back);
+    }
+}
+
+static reg_t bench_run(void (*sw)(struct context *next)){
+    bench_switch = sw;
+    bench_context.sp = (reg_t) &bench_stack[sizeof(bench_stack) - 8];
+    bench_context.pc = (reg_t) bench_partner;
+    bench_context.flag = CTX_FULL;
+    bench_context.mpp = MSTATUS_MPP;
+
+    /* 预热一次，让伙伴进入循环 */
+    sw(&bench_context);
+
+    reg_t start = r_mcycle();
+    for(int i = 0;i < BENCH_ROUNDS;i++){
+        sw(&bench_context);
     }
-    task->front->next = task->next;
-    task->next->front = task->front;
-    free(task);
-    now_task = NULL;
-    task_num--;
-    switch_to(&schedule_context);
-    return;
+    reg_t end = r_mcycle();
+    /* 每一轮包含两次切换 */
+    return (end - start) / (2 * BENCH_ROUNDS);
+}
+
+void switch_bench(){
+    reg_t flags = irq_save();
+    bench_back = (struct context *) r_mscratch();
+
+    reg_t full = bench_run(switch_to);
+    reg_t fast = bench_run(switch_to_fast);
+
+    irq_restore(flags);
+    printf("switch_to: %ld cycles, switch_to_fast: %ld cycles\n", full, fast);
 }
 
 /*
- * 描述：
- * 一个粗糙的delay实现，仅用来消耗CPU资源
+ * 调度器性能测试
+ * 在一个不参与调度的hart结构上放入n个就绪任务，反复调用pick_next_task()，
+ * 统计每次选择下一个任务平均消耗的mcycle周期数，
+ * 分别测试同一优先级轮转的SCHED_PRIO任务与按vruntime排序的SCHED_FAIR任务
+ * 每次选择都会访问不同任务的任务控制块，任务数增加时可以观察缓存未命中的影响
+ * 测试任务只分配不运行，其它hart看不到它们
  */
-void task_delay(volatile int count){
-    count *= 50000;
-    while(count--);
-}
\ No newline at end of file
+#define SCHED_BENCH_ROUNDS 1000
+#define SCHED_BENCH_MAX    256
+static struct Task *bench_tasks[SCHED_BENCH_MAX];
+
+static void bench_nop(void *param){
+}
+
+/* 返回n个任务时每次pick_next_task()的平均周期数，内存不足时返回0 */
+static reg_t sched_bench_run(int n, uint8_t policy){
+    struct hart *h = &harts[BENCH_HART];
+    hart_init(h);
+    int created = 0;
+    while(created < n){
+        struct Task *t = task_alloc(bench_nop, NULL, 0, STACK_MIN, 0);
+        if(t == NULL){
+            break;
+        }
+        if(policy == SCHED_FAIR){
+            t->policy = SCHED_FAIR;
+            t->priority = Priority_num - 1;
+        }
+        bench_tasks[created++] = t;
+        rq_enqueue(h, t);
+    }
+
+    reg_t start = 0;
+    reg_t end = 0;
+    if(created == n){
+        reg_t flags = irq_save();
+        spin_lock(&h->lock);
+        /* 预热一次，让每个任务都被选中过 */
+        for(int i = 0;i < n;i++){
+            pick_next_task(h);
+        }
+        start = r_mcycle();
+        for(int i = 0;i < SCHED_BENCH_ROUNDS;i++){
+            pick_next_task(h);
+        }
+        end = r_mcycle();
+        spin_unlock(&h->lock);
+        /* pick_next_task()修改了本hart的PMP栈保护区 */
+        if(this_hart()->now_task != NULL){
+            stack_guard_load(this_hart()->now_task);
+        }
+        irq_restore(flags);
+    }
+
+    for(int i = 0;i < created;i++){
+        rq_dequeue(h, bench_tasks[i]);
+        task_free(bench_tasks[i]);
+    }
+    return (end - start) / SCHED_BENCH_ROUNDS;
+}
+
+void sched_bench(){
+    printf("tasks   prio(cycles)   fair(cycles)\n");
+    for(int n = 1;n <= SCHED_BENCH_MAX;n *= 2){
+        reg_t prio = sched_bench_run(n, SCHED_PRIO);
+        reg_t fair = sched_bench_run(n, SCHED_FAIR);
+        printf("%5d %14ld %14ld\n", n, prio, fair);
+    }
+}
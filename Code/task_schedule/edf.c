@@ -0,0 +1,82 @@
+#include "task_schedule.h"
+
+/*
+ * EDF就绪队列：按照edf.deadline排序的二叉最小堆
+ * 每个任务在edf.heap_index中记录自己在堆中的下标，
+ * 因此删除任意任务与修改截止时间都是O(log n)
+ * 调用者需持有所属hart的就绪队列锁
+ */
+
+void edf_rq_init(struct edf_rq *rq){
+    rq->nr = 0;
+    rq->util = 0;
+}
+
+static inline int edf_before(struct Task *a, struct Task *b){
+    return a->edf.deadline < b->edf.deadline;
+}
+
+static inline void edf_set(struct edf_rq *rq, int i, struct Task *task){
+    rq->heap[i] = task;
+    task->edf.heap_index = i;
+}
+
+/* 将下标i处的任务向上调整 */
+static void edf_sift_up(struct edf_rq *rq, int i){
+    struct Task *task = rq->heap[i];
+    while(i > 0){
+        int parent = (i - 1) / 2;
+        if(!edf_before(task, rq->heap[parent])){
+            break;
+        }
+        edf_set(rq, i, rq->heap[parent]);
+        i = parent;
+    }
+    edf_set(rq, i, task);
+}
+
+/* 将下标i处的任务向下调整 */
+static void edf_sift_down(struct edf_rq *rq, int i){
+    struct Task *task = rq->heap[i];
+    while(1){
+        int child = 2 * i + 1;
+        if(child >= rq->nr){
+            break;
+        }
+        if(child + 1 < rq->nr && edf_before(rq->heap[child + 1], rq->heap[child])){
+            child++;
+        }
+        if(!edf_before(rq->heap[child], task)){
+            break;
+        }
+        edf_set(rq, i, rq->heap[child]);
+        i = child;
+    }
+    edf_set(rq, i, task);
+}
+
+/* 插入任务，准入控制保证堆不会溢出 */
+void edf_rq_insert(struct edf_rq *rq, struct Task *task){
+    int i = rq->nr++;
+    edf_set(rq, i, task);
+    edf_sift_up(rq, i);
+}
+
+/* 删除任务 */
+void edf_rq_remove(struct edf_rq *rq, struct Task *task){
+    int i = task->edf.heap_index;
+    struct Task *last = rq->heap[--rq->nr];
+    task->edf.heap_index = -1;
+    if(last == task){
+        return;
+    }
+    edf_set(rq, i, last);
+    /* 替补上来的任务可能比原来的父节点早，也可能比子节点晚 */
+    edf_sift_up(rq, i);
+    edf_sift_down(rq, last->edf.heap_index);
+}
+
+/* 返回截止时间最早的任务，堆为空时返回NULL */
+struct Task *edf_rq_first(struct edf_rq *rq){
+    return rq->nr > 0 ? rq->heap[0] : NULL;
+}
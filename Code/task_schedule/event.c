@@ -0,0 +1,229 @@
+#include "task_schedule.h"
+
+/*
+ * 事件组
+ *
+ * 任务等待一组标志位中的任意一位或全部被置位，等待期间离开就绪队列。
+ * 等待条件（struct event_wait）位于等待者的栈上，通过wait_data交给置位者，
+ * 置位者在持有事件组的锁时判断条件并直接唤醒满足条件的任务，
+ * 同时把满足时的标志位通过event_wait.result交给它，被唤醒的任务不需要再次检查。
+ * 等待者按等待条件分类（见struct event_class），同一类的条件总是同时满足，
+ * 置位时只需对每一类判断一次，只访问条件满足的类中的任务；
+ * 条件的种类超过EV_CLASSES时，其余的等待者放在公共的等待队列中逐个检查。
+ * 事件组记录所有等待者关心的位的并集，置位的标志与之无关时不检查任何等待者，
+ * 等待者超时离开时重新计算这个并集。
+ */
+
+/* 等待者的等待条件 */
+struct event_wait {
+	uint32_t mask;
+	int options;
+	uint32_t result;
+};
+
+/* 判断等待条件是否满足 */
+static int event_match(uint32_t flags, uint32_t mask, int options){
+    if(options & EV_ALL){
+        return (flags & mask) == mask;
+    }
+    return (flags & mask) != 0;
+}
+
+/*
+ * 描述：
+ * 初始化事件组，所有标志位为0
+ */
+void event_init(struct event_group *eg){
+    spin_init(&eg->lock);
+    eg->flags = 0;
+    eg->wait_bits = 0;
+    eg->misc_bits = 0;
+    for(int i = 0;i < EV_CLASSES;i++){
+        eg->cls[i].mask = 0;
+        eg->cls[i].all = 0;
+        wait_queue_init(&eg->cls[i].wq, WQ_PRIO);
+    }
+    wait_queue_init(&eg->wq, WQ_PRIO);
+}
+
+/*
+ * 返回等待条件为mask/all的任务应当加入的等待队列，调用者需持有eg->lock
+ * 优先使用条件相同的类，其次是空闲的类，都没有时使用公共的等待队列
+ */
+static struct wait_queue *event_queue(struct event_group *eg, uint32_t mask, int all){
+    struct event_class *free_cls = NULL;
+    for(int i = 0;i < EV_CLASSES;i++){
+        struct event_class *c = &eg->cls[i];
+        if(c->wq.head == NULL){
+            if(free_cls == NULL){
+                free_cls = c;
+            }
+        }else if(c->mask == mask && c->all == all){
+            return &c->wq;
+        }
+    }
+    if(free_cls != NULL){
+        free_cls->mask = mask;
+        free_cls->all = all;
+        return &free_cls->wq;
+    }
+    return &eg->wq;
+}
+
+/* 重新计算公共等待队列与所有等待者关心的位的并集，调用者需持有eg->lock */
+static void event_update_bits(struct event_group *eg){
+    uint32_t misc = 0;
+    for(struct Task *task = eg->wq.head;task != NULL;task = task->wait_next){
+        misc |= ((struct event_wait *)task->wait_data)->mask;
+    }
+    eg->misc_bits = misc;
+    uint32_t bits = misc;
+    for(int i = 0;i < EV_CLASSES;i++){
+        if(eg->cls[i].wq.head != NULL){
+            bits |= eg->cls[i].mask;
+        }
+    }
+    eg->wait_bits = bits;
+}
+
+/*
+ * 描述：
+ * 置位标志位，唤醒所有因此满足条件的任务
+ * 带EV_CLEAR的等待者要求清除的位在扫描完所有等待者之后才清除，
+ * 等待同一位的多个任务都会被唤醒
+ * 不会阻塞，可以在中断处理函数中调用
+ * 返回值：
+ * 置位（以及清除）之后的标志位
+ */
+uint32_t event_set(struct event_group *eg, uint32_t bits){
+    reg_t flags = irq_save();
+    spin_lock(&eg->lock);
+    eg->flags |= bits;
+    if(bits & eg->wait_bits){
+        uint32_t clear = 0;
+        /* 等待中的类的条件此前一定不满足，只有mask与bits有交集的类才可能因此满足 */
+        for(int i = 0;i < EV_CLASSES;i++){
+            struct event_class *c = &eg->cls[i];
+            if(c->wq.head == NULL || (c->mask & bits) == 0
+               || !event_match(eg->flags, c->mask, c->all ? EV_ALL : EV_ANY)){
+                continue;
+            }
+            struct Task *task;
+            while((task = wait_queue_pop(&c->wq)) != NULL){
+                struct event_wait *ew = (struct event_wait *)task->wait_data;
+                ew->result = eg->flags;
+                if(ew->options & EV_CLEAR){
+                    clear |= ew->mask;
+                }
+                task_wakeup(task);
+            }
+        }
+        if(bits & eg->misc_bits){
+            struct Task **pos = &eg->wq.head;
+            while(*pos != NULL){
+                struct Task *task = *pos;
+                struct event_wait *ew = (struct event_wait *)task->wait_data;
+                if(event_match(eg->flags, ew->mask, ew->options)){
+                    ew->result = eg->flags;
+                    if(ew->options & EV_CLEAR){
+                        clear |= ew->mask;
+                    }
+                    /* 与wait_queue_pop()相同，先取出再唤醒 */
+                    *pos = task->wait_next;
+                    task->wait_next = NULL;
+                    task->wait_on = NULL;
+                    task_wakeup(task);
+                }else{
+                    pos = &task->wait_next;
+                }
+            }
+        }
+        eg->flags &= ~clear;
+        event_update_bits(eg);
+    }
+    uint32_t ret = eg->flags;
+    spin_unlock(&eg->lock);
+    irq_restore(flags);
+    return ret;
+}
+
+/*
+ * 描述：
+ * 清除标志位，可以在中断处理函数中调用
+ * 返回值：
+ * 清除之前的标志位
+ */
+uint32_t event_clear(struct event_group *eg, uint32_t bits){
+    reg_t flags = irq_save();
+    spin_lock(&eg->lock);
+    uint32_t ret = eg->flags;
+    eg->flags &= ~bits;
+    spin_unlock(&eg->lock);
+    irq_restore(flags);
+    return ret;
+}
+
+/* 返回当前的标志位 */
+uint32_t event_get(struct event_group *eg){
+    return *(volatile uint32_t *)&eg->flags;
+}
+
+/*
+ * 描述：
+ * 等待mask中的任意一位或全部被置位，最多等待timeout个时间片
+ * - mask：关心的标志位，不能为0
+ * - options：EV_ANY或EV_ALL，可以再加上EV_CLEAR
+ * - timeout：超时的时间片数，0表示不等待，WAIT_FOREVER表示一直等待
+ * - flags：不为NULL时返回条件满足时（清除之前）的标志位，超时时为当前的标志位
+ * 返回值：
+ * 0：条件满足
+ * -1：超时（或timeout为0时条件不满足），mask为0
+ */
+int event_wait(struct event_group *eg, uint32_t mask, int options,
+               uint64_t timeout, uint32_t *flags){
+    if(mask == 0){
+        return -1;
+    }
+    int ret = 0;
+    uint32_t result;
+    reg_t irq = irq_save();
+    spin_lock(&eg->lock);
+    if(event_match(eg->flags, mask, options)){
+        result = eg->flags;
+        if(options & EV_CLEAR){
+            eg->flags &= ~mask;
+        }
+        spin_unlock(&eg->lock);
+    }else if(timeout == 0){
+        result = eg->flags;
+        spin_unlock(&eg->lock);
+        ret = -1;
+    }else{
+        struct event_wait ew;
+        ew.mask = mask;
+        ew.options = options;
+        ew.result = 0;
+        task_self()->wait_data = &ew;
+        struct wait_queue *wq = event_queue(eg, mask, options & EV_ALL);
+        if(wq == &eg->wq){
+            eg->misc_bits |= mask;
+        }
+        eg->wait_bits |= mask;
+        /* event_set()通过ew.result交给当前任务满足时的标志位后才会唤醒 */
+        ret = wait_queue_sleep_timeout(wq, &eg->lock, timeout);
+        if(ret == 0){
+            result = ew.result;
+        }else{
+            /* 超时离开后重新计算并集，不留下已经没有等待者的位 */
+            spin_lock(&eg->lock);
+            event_update_bits(eg);
+            result = eg->flags;
+            spin_unlock(&eg->lock);
+        }
+    }
+    irq_restore(irq);
+    if(flags != NULL){
+        *flags = result;
+    }
+    return ret;
+}
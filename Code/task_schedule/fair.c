@@ -0,0 +1,164 @@
+#include "task_schedule.h"
+
+/*
+ * 公平调度类的就绪队列：按照虚拟运行时间排序的树堆（treap）
+ * 每个节点除了排序键（vruntime，相同时按任务地址）之外还有一个随机的堆优先级，
+ * 树的形状与插入顺序无关，插入、删除与查找的期望复杂度均为O(log n)，
+ * 实现只需要旋转，不需要红黑树那样的颜色调整
+ * 调用者需持有所属hart的就绪队列锁
+ */
+
+/*
+ * nice值到权重的映射，nice为0时权重为1024，nice每增加1权重约减少到1/1.25
+ * ref: linux/kernel/sched/core.c sched_prio_to_weight
+ */
+static const uint32_t nice_to_weight[FAIR_NICE_MAX - FAIR_NICE_MIN + 1] = {
+	/* -20 */ 88761, 71755, 56483, 46273, 36291,
+	/* -15 */ 29154, 23254, 18705, 14949, 11916,
+	/* -10 */  9548,  7620,  6100,  4904,  3906,
+	/*  -5 */  3121,  2501,  1991,  1586,  1277,
+	/*   0 */  1024,   820,   655,   526,   423,
+	/*   5 */   335,   272,   215,   172,   137,
+	/*  10 */   110,    87,    70,    56,    45,
+	/*  15 */    36,    29,    23,    18,    15,
+};
+
+/* 返回nice值对应的权重，超出范围的nice值被截断 */
+uint32_t fair_weight(int nice){
+    if(nice < FAIR_NICE_MIN){
+        nice = FAIR_NICE_MIN;
+    }
+    if(nice > FAIR_NICE_MAX){
+        nice = FAIR_NICE_MAX;
+    }
+    return nice_to_weight[nice - FAIR_NICE_MIN];
+}
+
+void fair_rq_init(struct fair_rq *rq){
+    rq->root = NULL;
+    rq->min_vruntime = 0;
+    rq->nr = 0;
+    rq->seed = 0x9e3779b9;
+}
+
+/* a是否排在b之前，vruntime可能回绕，按差值的符号比较 */
+static inline int fair_before(struct Task *a, struct Task *b){
+    int64_t diff = (int64_t)(a->fair.vruntime - b->fair.vruntime);
+    if(diff != 0){
+        return diff < 0;
+    }
+    return a < b;
+}
+
+/* xorshift32伪随机数，作为节点的堆优先级 */
+static uint32_t fair_random(struct fair_rq *rq){
+    uint32_t x = rq->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rq->seed = x;
+    return x;
+}
+
+static struct Task *rotate_right(struct Task *node){
+    struct Task *left = node->fair.left;
+    node->fair.left = left->fair.right;
+    left->fair.right = node;
+    return left;
+}
+
+static struct Task *rotate_left(struct Task *node){
+    struct Task *right = node->fair.right;
+    node->fair.right = right->fair.left;
+    right->fair.left = node;
+    return right;
+}
+
+static struct Task *treap_insert(struct Task *node, struct Task *task){
+    if(node == NULL){
+        return task;
+    }
+    if(fair_before(task, node)){
+        node->fair.left = treap_insert(node->fair.left, task);
+        if(node->fair.left->fair.heap_prio > node->fair.heap_prio){
+            node = rotate_right(node);
+        }
+    }else{
+        node->fair.right = treap_insert(node->fair.right, task);
+        if(node->fair.right->fair.heap_prio > node->fair.heap_prio){
+            node = rotate_left(node);
+        }
+    }
+    return node;
+}
+
+/* 合并两棵子树，left中的所有节点都排在right之前 */
+static struct Task *treap_merge(struct Task *left, struct Task *right){
+    if(left == NULL){
+        return right;
+    }
+    if(right == NULL){
+        return left;
+    }
+    if(left->fair.heap_prio > right->fair.heap_prio){
+        left->fair.right = treap_merge(left->fair.right, right);
+        return left;
+    }
+    right->fair.left = treap_merge(left, right->fair.left);
+    return right;
+}
+
+static struct Task *treap_remove(struct Task *node, struct Task *task){
+    if(node == task){
+        return treap_merge(node->fair.left, node->fair.right);
+    }
+    if(fair_before(task, node)){
+        node->fair.left = treap_remove(node->fair.left, task);
+    }else{
+        node->fair.right = treap_remove(node->fair.right, task);
+    }
+    return node;
+}
+
+void fair_rq_insert(struct fair_rq *rq, struct Task *task){
+    task->fair.left = NULL;
+    task->fair.right = NULL;
+    task->fair.heap_prio = fair_random(rq);
+    rq->root = treap_insert(rq->root, task);
+    rq->nr++;
+}
+
+/* 删除任务，任务的vruntime在插入之后不能被修改 */
+void fair_rq_remove(struct fair_rq *rq, struct Task *task){
+    rq->root = treap_remove(rq->root, task);
+    task->fair.left = NULL;
+    task->fair.right = NULL;
+    rq->nr--;
+}
+
+/* 返回vruntime最小的任务，队列为空时返回NULL */
+struct Task *fair_rq_first(struct fair_rq *rq){
+    struct Task *node = rq->root;
+    if(node == NULL){
+        return NULL;
+    }
+    while(node->fair.left != NULL){
+        node = node->fair.left;
+    }
+    return node;
+}
+
+/* 返回排在task之后的下一个任务，没有时返回NULL */
+struct Task *fair_rq_next(struct fair_rq *rq, struct Task *task){
+    struct Task *next = NULL;
+    struct Task *node = rq->root;
+    while(node != NULL){
+        if(fair_before(task, node)){
+            next = node;
+            node = node->fair.left;
+        }else{
+            node = node->fair.right;
+        }
+    }
+    return next;
+}
@@ -0,0 +1,171 @@
+#include "task_schedule.h"
+
+/*
+ * 任务组的CPU配额
+ *
+ * 调度器每次记账时把当前任务运行的时间从其任务组的配额中扣除，
+ * 配额用完后任务组被节流：组内的任务在被调度器选中时移出就绪队列，
+ * 挂入任务组的throttled_tasks链表（见pick_next_task()）。
+ * hart 0的定时器中断在每个周期开始时补充配额，并唤醒被节流的任务。
+ * 加锁顺序为 group_list_lock -> 任务组的锁，以及 就绪队列的锁 -> 任务组的锁，
+ * 唤醒被节流的任务时不持有任务组的锁
+ */
+
+/* 所有任务组组成的链表，由group_list_lock保护 */
+static struct task_group *group_list = NULL;
+static struct spinlock group_list_lock;
+
+/*
+ * 描述：
+ * 创建任务组，之后通过task_group_attach()加入任务
+ * - quota_us：每个周期内组内任务合计的运行时间上限，微秒
+ * - period_us：周期，微秒，补充配额的时间向上对齐到时间片边界
+ * 返回值：
+ * 任务组，参数错误或内存不足时返回NULL
+ */
+struct task_group *task_group_create(uint64_t quota_us, uint64_t period_us){
+    uint64_t quota = timer_us_to_cycles(quota_us);
+    uint64_t period = timer_us_to_cycles(period_us);
+    if(quota == 0 || period == 0){
+        return NULL;
+    }
+    struct task_group *g = (struct task_group *)malloc(sizeof(struct task_group));
+    if(g == NULL){
+        return NULL;
+    }
+    spin_init(&g->lock);
+    g->quota = quota;
+    g->period = period;
+    g->runtime_left = quota;
+    g->next_refill = timer_get_mtime() + period;
+    g->throttled = 0;
+    g->throttle_start = 0;
+    g->throttled_tasks = NULL;
+    g->nr_periods = 0;
+    g->nr_throttled = 0;
+    g->throttled_time = 0;
+
+    reg_t flags = irq_save();
+    spin_lock(&group_list_lock);
+    g->next = group_list;
+    group_list = g;
+    spin_unlock(&group_list_lock);
+    irq_restore(flags);
+    return g;
+}
+
+/*
+ * 描述：
+ * 将任务加入任务组，之后的运行时间计入该组的配额
+ * - g：任务组，为NULL时任务不再受配额限制
+ */
+void task_group_attach(struct task_group *g, struct Task *task){
+    task->group = g;
+}
+
+/*
+ * 由调度器记账时调用（持有就绪队列的锁），从配额中扣除运行时间
+ * 配额用完时节流任务组，并通知hart 0按时补充配额
+ * - delta：运行的mtime计数周期数
+ */
+void task_group_charge(struct task_group *g, uint64_t delta){
+    int throttle = 0;
+    spin_lock(&g->lock);
+    g->runtime_left -= delta;
+    if(g->runtime_left <= 0 && !g->throttled){
+        g->throttled = 1;
+        g->throttle_start = timer_get_mtime();
+        g->nr_throttled++;
+        throttle = 1;
+    }
+    spin_unlock(&g->lock);
+    if(throttle){
+        /* hart 0空闲时可能没有装载定时器 */
+        sched_kick(0);
+    }
+}
+
+/*
+ * 由调度器在选中被节流的任务组中的任务时调用（持有就绪队列的锁）
+ * 任务组仍处于节流状态时把任务挂入throttled_tasks，
+ * 调用者随后将其移出就绪队列并设为TASK_BLOCKED，
+ * 补充配额时由task_wakeup()放回就绪队列
+ * 返回值：
+ * 1：任务已被挂入throttled_tasks
+ * 0：任务组已经补充了配额，任务可以继续运行
+ */
+int task_group_park(struct task_group *g, struct Task *task){
+    int parked = 0;
+    spin_lock(&g->lock);
+    if(g->throttled){
+        task->throttle_next = g->throttled_tasks;
+        g->throttled_tasks = task;
+        parked = 1;
+    }
+    spin_unlock(&g->lock);
+    return parked;
+}
+
+/*
+ * 由hart 0的定时器中断调用，为到达周期边界的任务组补充配额
+ * 上个周期超出的部分从新的配额中扣除，
+ * 配额恢复为正数时解除节流，唤醒被节流的任务
+ * - now：当前的mtime
+ */
+void task_group_refill(uint64_t now){
+    spin_lock(&group_list_lock);
+    for(struct task_group *g = group_list;g != NULL;g = g->next){
+        struct Task *wake = NULL;
+        spin_lock(&g->lock);
+        if(now >= g->next_refill){
+            uint64_t n = (now - g->next_refill) / g->period + 1;
+            g->next_refill += n * g->period;
+            g->nr_periods += n;
+            g->runtime_left += n * g->quota;
+            if(g->runtime_left > (int64_t)g->quota){
+                g->runtime_left = g->quota;
+            }
+            if(g->throttled && g->runtime_left > 0){
+                g->throttled = 0;
+                g->throttled_time += now - g->throttle_start;
+                wake = g->throttled_tasks;
+                g->throttled_tasks = NULL;
+            }
+        }
+        spin_unlock(&g->lock);
+
+        while(wake != NULL){
+            struct Task *next = wake->throttle_next;
+            wake->throttle_next = NULL;
+            task_wakeup(wake);
+            wake = next;
+        }
+    }
+    spin_unlock(&group_list_lock);
+}
+
+/*
+ * 返回最早需要补充配额的被节流任务组的补充时间（时间片计数），
+ * 供hart 0空闲时装载定时器
+ * 返回值：
+ * 时间片计数，没有被节流的任务组时返回0
+ */
+uint64_t task_group_next_refill(){
+    uint64_t next = 0;
+    reg_t flags = irq_save();
+    spin_lock(&group_list_lock);
+    for(struct task_group *g = group_list;g != NULL;g = g->next){
+        if(g->throttled && (next == 0 || g->next_refill < next)){
+            next = g->next_refill;
+        }
+    }
+    spin_unlock(&group_list_lock);
+    irq_restore(flags);
+    return next == 0 ? 0 : timer_mtime_to_tick(next);
+}
+
+/* 打印任务组的配额与节流统计，用于调整配额 */
+void task_group_stat(struct task_group *g){
+    printf("group: quota: %ld/%ld, periods: %ld, throttled: %ld, throttled time: %ld\n",
+           g->quota, g->period, g->nr_periods, g->nr_throttled, g->throttled_time);
+}
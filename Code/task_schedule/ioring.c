@@ -0,0 +1,431 @@
+#include "task_schedule.h"
+
+/*
+ * 异步提交/完成环的内核一侧，环的共享部分见ioring.h
+ *
+ * 所有的环共用一个服务任务：io_ring_submit()把有新请求的环挂入待处理链表并唤醒服务任务，
+ * 服务任务每次取走整条链表，依次处理每个环中已提交的全部请求，
+ * 一批请求的完成项写完后才发布cq_tail并唤醒等待的任务，每个环每批只唤醒一次。
+ * IO_TIMEOUT不占用服务任务：到期时间记录在按时间排序的定时链表中，
+ * 服务任务按最早的到期时间限时睡眠，醒来时完成到期的请求。
+ * 环的内核状态保存在静态分配的描述符表中，用户模式的任务无法访问（见user_pmp_init()），
+ * 共享部分由任务随意改写也不会让内核访问描述符记录的数组之外的内存。
+ * 加锁顺序为 io_lock -> 描述符的锁
+ */
+
+/* 服务任务的优先级，高于普通任务，使提交的请求尽快得到处理 */
+#define IO_SERVICE_PRIO 1
+
+/* 同时存在的环的数量上限 */
+#define IO_RING_MAX 16
+
+/*
+ * 环的内核描述符
+ * ring：共享部分，为NULL表示描述符空闲
+ * entries/sqes/cqes：创建时记录的队列大小与数组位置，不从共享部分读取
+ * sq_head/cq_tail：内核一侧的下标，处理请求时发布到共享部分
+ * cq_want：在io_ring_wait()中等待的任务需要的完成项数
+ * lock：保护wq与cq_want，服务任务在持有它时发布cq_tail
+ * wq：在io_ring_wait()中等待的任务
+ * pend_next/queued：有新提交的请求时挂入服务任务的待处理链表，由io_lock保护
+ * inflight：尚未到期的IO_TIMEOUT请求数，只由服务任务访问
+ * user：由用户模式的任务通过SYS_io_setup创建，请求中的地址需要用user_access_ok()检查
+ */
+struct io_ring_desc {
+	struct io_ring *ring;
+	uint32_t entries;
+	uint32_t sq_head;
+	uint32_t cq_tail;
+	uint32_t cq_want;
+	struct io_sqe *sqes;
+	struct io_cqe *cqes;
+	struct spinlock lock;
+	struct wait_queue wq;
+	struct io_ring_desc *pend_next;
+	int queued;
+	int user;
+	uint32_t inflight;
+};
+
+/* 一个尚未到期的IO_TIMEOUT请求，只由服务任务访问 */
+struct io_timeout {
+	uint64_t expire_tick;
+	struct io_ring_desc *ring;
+	uint64_t user_data;
+	struct io_timeout *next;
+};
+
+/*
+ * io_lock：保护io_rings的分配、io_pending、io_current与io_wq
+ * io_rings：环的描述符表
+ * io_pending：有新提交的请求的环组成的链表
+ * io_current：服务任务正在处理的环，删除环时需等它处理完
+ * io_wq：服务任务在此等待新的请求
+ * io_timeouts：按到期时间排序的定时链表
+ */
+static struct spinlock io_lock;
+static struct io_ring_desc io_rings[IO_RING_MAX];
+static struct io_ring_desc *io_pending = NULL;
+static struct io_ring_desc *io_current = NULL;
+static struct wait_queue io_wq;
+static struct io_timeout *io_timeouts = NULL;
+static volatile int io_service_started = 0;
+
+/* 返回环的描述符，r不是io_ring_create()返回的环时返回NULL */
+static struct io_ring_desc *io_ring_get(struct io_ring *r){
+    uint32_t id = r->id;
+    if(id >= IO_RING_MAX || io_rings[id].ring != r){
+        return NULL;
+    }
+    return &io_rings[id];
+}
+
+/* 写入一个完成项，发布之前任务看不到它 */
+static void io_post(struct io_ring_desc *d, uint32_t *tail, uint64_t user_data, int64_t res){
+    struct io_cqe *cqe = &d->cqes[*tail & (d->entries - 1)];
+    cqe->user_data = user_data;
+    cqe->res = res;
+    (*tail)++;
+}
+
+/* 发布完成项，完成项足够时唤醒在io_ring_wait()中等待的任务 */
+static void io_publish(struct io_ring_desc *d, uint32_t tail){
+    reg_t flags = irq_save();
+    spin_lock(&d->lock);
+    __sync_synchronize();
+    d->cq_tail = tail;
+    d->ring->cq_tail = tail;
+    if(d->wq.head != NULL && tail - d->ring->cq_head >= d->cq_want){
+        wait_queue_wake_all(&d->wq);
+    }
+    spin_unlock(&d->lock);
+    irq_restore(flags);
+}
+
+/* 按到期时间插入定时链表 */
+static void io_timeout_add(struct io_ring_desc *d, uint64_t us, uint64_t user_data){
+    struct io_timeout *t = (struct io_timeout *)malloc(sizeof(struct io_timeout));
+    if(t == NULL){
+        uint32_t tail = d->cq_tail;
+        io_post(d, &tail, user_data, -1);
+        io_publish(d, tail);
+        return;
+    }
+    t->expire_tick = timer_get_tick() + timer_us_to_tick(us);
+    t->ring = d;
+    t->user_data = user_data;
+    struct io_timeout **pos = &io_timeouts;
+    while(*pos != NULL && (*pos)->expire_tick <= t->expire_tick){
+        pos = &(*pos)->next;
+    }
+    t->next = *pos;
+    *pos = t;
+    d->inflight++;
+}
+
+/* 完成所有到期的IO_TIMEOUT请求 */
+static void io_timeout_expire(){
+    uint64_t now = timer_get_tick();
+    while(io_timeouts != NULL && io_timeouts->expire_tick <= now){
+        struct io_timeout *t = io_timeouts;
+        io_timeouts = t->next;
+        uint32_t tail = t->ring->cq_tail;
+        io_post(t->ring, &tail, t->user_data, 0);
+        io_publish(t->ring, tail);
+        t->ring->inflight--;
+        free(t);
+    }
+}
+
+/*
+ * 处理一个环中已提交的全部请求
+ * 除IO_TIMEOUT外的请求立即完成，完成项在整批处理完后一起发布
+ * 请求先读入局部变量再检查与执行，任务在此期间改写提交队列项不会影响检查的结果
+ */
+static void io_drain(struct io_ring_desc *d){
+    uint32_t head = d->sq_head;
+    uint32_t end = d->ring->sq_tail;
+    /* sq_tail由任务写入，一次最多处理entries个请求 */
+    if(end - head > d->entries){
+        end = head + d->entries;
+    }
+    uint32_t tail = d->cq_tail;
+    __sync_synchronize();
+    while(head != end){
+        struct io_sqe *sqe = &d->sqes[head & (d->entries - 1)];
+        uint8_t opcode = sqe->opcode;
+        uint32_t len = sqe->len;
+        uint64_t addr = sqe->addr;
+        uint64_t user_data = sqe->user_data;
+        int64_t res = 0;
+        switch(opcode){
+        case IO_NOP:
+            break;
+        case IO_WRITE:
+            if(d->user && !user_access_ok(addr, len, 0)){
+                res = -1;
+                break;
+            }
+            for(uint32_t i = 0;i < len;i++){
+                uart_putc(((char *)addr)[i]);
+            }
+            res = len;
+            break;
+        case IO_TIMEOUT:
+            /* 先发布已完成的请求，定时链表中的请求到期时单独发布 */
+            io_publish(d, tail);
+            io_timeout_add(d, addr, user_data);
+            tail = d->cq_tail;
+            head++;
+            continue;
+        case IO_MALLOC:
+            res = (int64_t)malloc(len);
+            break;
+        case IO_FREE:
+            if(d->user && addr != 0 && !user_access_ok(addr, 0, 1)){
+                res = -1;
+                break;
+            }
+            free((void *)addr);
+            break;
+        default:
+            res = -1;
+            break;
+        }
+        io_post(d, &tail, user_data, res);
+        head++;
+    }
+    d->sq_head = head;
+    d->ring->sq_head = head;
+    io_publish(d, tail);
+}
+
+/*
+ * 服务任务
+ * 取走待处理链表，逐个处理其中的环，然后完成到期的定时请求；
+ * 没有新的请求时睡眠，有定时请求时最多睡到最早的到期时间
+ */
+static void io_service(void *param){
+    while(1){
+        reg_t flags = irq_save();
+        spin_lock(&io_lock);
+        while(io_pending == NULL){
+            uint64_t timeout = WAIT_FOREVER;
+            if(io_timeouts != NULL){
+                uint64_t now = timer_get_tick();
+                if(io_timeouts->expire_tick <= now){
+                    break;
+                }
+                timeout = io_timeouts->expire_tick - now;
+            }
+            wait_queue_sleep_timeout(&io_wq, &io_lock, timeout);
+            spin_lock(&io_lock);
+        }
+        struct io_ring_desc *d = io_pending;
+        io_pending = NULL;
+        while(d != NULL){
+            /* 先清除queued，处理期间提交的请求会让环重新挂入链表 */
+            struct io_ring_desc *next = d->pend_next;
+            d->pend_next = NULL;
+            d->queued = 0;
+            io_current = d;
+            spin_unlock(&io_lock);
+            irq_restore(flags);
+
+            io_drain(d);
+
+            flags = irq_save();
+            spin_lock(&io_lock);
+            io_current = NULL;
+            d = next;
+        }
+        spin_unlock(&io_lock);
+        irq_restore(flags);
+
+        io_timeout_expire();
+    }
+}
+
+/*
+ * 分配环的共享部分与描述符，第一次调用时创建服务任务
+ * - user：是否由用户模式的任务创建
+ */
+static struct io_ring *io_ring_alloc(uint32_t entries, int user){
+    if(entries == 0 || entries > 4096){
+        return NULL;
+    }
+    uint32_t n = 1;
+    while(n < entries){
+        n <<= 1;
+    }
+    if(!io_service_started && __sync_bool_compare_and_swap(&io_service_started, 0, 1)){
+        spin_init(&io_lock);
+        wait_queue_init(&io_wq, WQ_FIFO);
+        if(task_create(io_service, NULL, IO_SERVICE_PRIO, 0) == NULL){
+            io_service_started = 0;
+            return NULL;
+        }
+    }
+    struct io_ring *r = (struct io_ring *)malloc(sizeof(struct io_ring)
+                                                 + n * (sizeof(struct io_sqe) + sizeof(struct io_cqe)));
+    if(r == NULL){
+        return NULL;
+    }
+    r->sq_head = 0;
+    r->sq_tail = 0;
+    r->cq_head = 0;
+    r->cq_tail = 0;
+    r->sqe_tail = 0;
+    r->entries = n;
+    r->sqes = (struct io_sqe *)(r + 1);
+    r->cqes = (struct io_cqe *)(r->sqes + n);
+
+    reg_t flags = irq_save();
+    spin_lock(&io_lock);
+    struct io_ring_desc *d = NULL;
+    for(uint32_t i = 0;i < IO_RING_MAX;i++){
+        if(io_rings[i].ring == NULL){
+            d = &io_rings[i];
+            r->id = i;
+            break;
+        }
+    }
+    if(d != NULL){
+        d->entries = n;
+        d->sq_head = 0;
+        d->cq_tail = 0;
+        d->cq_want = 0;
+        d->sqes = r->sqes;
+        d->cqes = r->cqes;
+        spin_init(&d->lock);
+        wait_queue_init(&d->wq, WQ_FIFO);
+        d->pend_next = NULL;
+        d->queued = 0;
+        d->user = user;
+        d->inflight = 0;
+        d->ring = r;
+    }
+    spin_unlock(&io_lock);
+    irq_restore(flags);
+    if(d == NULL){
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+/*
+ * 描述：
+ * 创建提交/完成环，第一次调用时创建服务任务
+ * - entries：队列的项数，向上取整为2的幂
+ * 返回值：
+ * 环，参数错误、内存不足或环的数量达到IO_RING_MAX时返回NULL
+ */
+struct io_ring *io_ring_create(uint32_t entries){
+    return io_ring_alloc(entries, 0);
+}
+
+/* 同io_ring_create()，供SYS_io_setup使用，请求中的地址会被检查 */
+struct io_ring *io_ring_create_user(uint32_t entries){
+    return io_ring_alloc(entries, 1);
+}
+
+/*
+ * 描述：
+ * 删除环
+ * 返回值：
+ * 0：成功
+ * -1：r不是有效的环，仍有未完成的请求或等待的任务，或者服务任务正在处理该环
+ */
+int io_ring_delete(struct io_ring *r){
+    struct io_ring_desc *d = io_ring_get(r);
+    if(d == NULL){
+        return -1;
+    }
+    reg_t flags = irq_save();
+    spin_lock(&io_lock);
+    spin_lock(&d->lock);
+    int busy = d->queued || io_current == d || d->inflight != 0
+               || r->sq_tail != d->sq_head || d->wq.head != NULL;
+    if(!busy){
+        d->ring = NULL;
+    }
+    spin_unlock(&d->lock);
+    spin_unlock(&io_lock);
+    irq_restore(flags);
+    if(busy){
+        return -1;
+    }
+    free(r);
+    return 0;
+}
+
+/*
+ * 描述：
+ * 提交io_get_sqe()取得的全部请求，不会阻塞
+ * 返回值：
+ * 本次提交的请求数，r不是有效的环时返回-1
+ */
+int io_ring_submit(struct io_ring *r){
+    struct io_ring_desc *d = io_ring_get(r);
+    if(d == NULL){
+        return -1;
+    }
+    uint32_t n = r->sqe_tail - r->sq_tail;
+    if(n == 0){
+        return 0;
+    }
+    __sync_synchronize();
+    r->sq_tail = r->sqe_tail;
+
+    reg_t flags = irq_save();
+    spin_lock(&io_lock);
+    if(!d->queued){
+        d->queued = 1;
+        d->pend_next = io_pending;
+        io_pending = d;
+        wait_queue_wake_one(&io_wq);
+    }
+    spin_unlock(&io_lock);
+    irq_restore(flags);
+    return n;
+}
+
+/*
+ * 描述：
+ * 等待完成队列中至少有min_complete个完成项，之后用io_peek_cqe()取回
+ * - timeout：超时的时间片数，WAIT_FOREVER表示一直等待
+ * 返回值：
+ * 0：完成项已经足够
+ * -1：超时，或r不是有效的环
+ */
+int io_ring_wait(struct io_ring *r, uint32_t min_complete, uint64_t timeout){
+    struct io_ring_desc *d = io_ring_get(r);
+    if(d == NULL){
+        return -1;
+    }
+    int ret = 0;
+    uint64_t deadline = timer_get_tick() + timeout;
+    reg_t flags = irq_save();
+    spin_lock(&d->lock);
+    while(d->cq_tail - r->cq_head < min_complete){
+        uint64_t left = WAIT_FOREVER;
+        if(timeout != WAIT_FOREVER){
+            uint64_t now = timer_get_tick();
+            if(now >= deadline){
+                ret = -1;
+                break;
+            }
+            left = deadline - now;
+        }
+        /* 多个任务等待时按最少的需求唤醒，醒来后各自重新检查 */
+        if(d->wq.head == NULL || min_complete < d->cq_want){
+            d->cq_want = min_complete;
+        }
+        wait_queue_sleep_timeout(&d->wq, &d->lock, left);
+        spin_lock(&d->lock);
+    }
+    spin_unlock(&d->lock);
+    irq_restore(flags);
+    return ret;
+}
@@ -0,0 +1,113 @@
+#include "task_schedule.h"
+
+/*
+ * 唤醒到运行的延迟直方图
+ *
+ * 任务被唤醒（包括在中断处理函数中被唤醒）或创建时，task_wakeup()等记录进入就绪队列的时间，
+ * 调度器第一次选中它时把两者之差记入该任务所在hart、所在优先级的直方图。
+ * 直方图按照延迟的log2分桶，存储全部静态分配；
+ * 每个hart只写自己的直方图，且写入时持有该hart的就绪队列锁，不需要原子操作。
+ */
+
+#if SCHED_LATENCY
+/*
+ * bucket：各桶的计数
+ * count/max：样本数与最大延迟（mtime计数周期）
+ */
+struct lat_hist {
+	uint32_t bucket[LAT_BUCKETS];
+	uint32_t count;
+	uint64_t max;
+};
+
+static struct lat_hist lat_hist[MAXNUM_CPU][Priority_num];
+
+/*
+ * 记录一次延迟，由调度器在持有hart的就绪队列锁时调用
+ * - hart：任务被调度运行的hart
+ * - priority：任务的优先级
+ * - delta：唤醒到运行的延迟，mtime计数周期
+ */
+void lat_record(int hart, uint8_t priority, uint64_t delta){
+    struct lat_hist *hist = &lat_hist[hart][priority];
+    int b = __fls64(delta);
+    if(b >= LAT_BUCKETS){
+        b = LAT_BUCKETS - 1;
+    }
+    hist->bucket[b]++;
+    hist->count++;
+    if(delta > hist->max){
+        hist->max = delta;
+    }
+}
+
+/* 返回第rank个样本（从1开始）所在桶的上界，单位为mtime计数周期 */
+static uint64_t lat_percentile(uint32_t *bucket, uint32_t rank){
+    uint32_t sum = 0;
+    for(int b = 0;b < LAT_BUCKETS;b++){
+        sum += bucket[b];
+        if(sum >= rank){
+            return b == 0 ? 0 : (1ULL << b) - 1;
+        }
+    }
+    return -1ULL;
+}
+
+/*
+ * 描述：
+ * 合并各hart的直方图，按优先级打印唤醒到运行延迟的p50/p99/max，单位为微秒
+ * p50/p99取所在log2桶的上界，max为精确值
+ * 读取时不加锁，与正在进行的记录并发时结果可能有少量偏差
+ */
+void latency_stat(){
+    uint32_t bucket[LAT_BUCKETS];
+    printf("prio    count      p50(us)      p99(us)      max(us)\n");
+    for(int prio = 0;prio < Priority_num;prio++){
+        uint32_t count = 0;
+        uint64_t max = 0;
+        for(int b = 0;b < LAT_BUCKETS;b++){
+            bucket[b] = 0;
+        }
+        for(int id = 0;id < MAXNUM_CPU;id++){
+            struct lat_hist *hist = &lat_hist[id][prio];
+            for(int b = 0;b < LAT_BUCKETS;b++){
+                bucket[b] += hist->bucket[b];
+            }
+            count += hist->count;
+            if(hist->max > max){
+                max = hist->max;
+            }
+        }
+        if(count == 0){
+            continue;
+        }
+        uint64_t p50 = lat_percentile(bucket, (count + 1) / 2);
+        uint64_t p99 = lat_percentile(bucket, count - count / 100);
+        printf("%4d %8d %12ld %12ld %12ld\n", prio, count,
+               timer_cycles_to_us(p50), timer_cycles_to_us(p99), timer_cycles_to_us(max));
+    }
+}
+
+/* 清空所有直方图 */
+void latency_reset(){
+    reg_t flags = irq_save();
+    for(int id = 0;id < MAXNUM_CPU;id++){
+        for(int prio = 0;prio < Priority_num;prio++){
+            struct lat_hist *hist = &lat_hist[id][prio];
+            for(int b = 0;b < LAT_BUCKETS;b++){
+                hist->bucket[b] = 0;
+            }
+            hist->count = 0;
+            hist->max = 0;
+        }
+    }
+    irq_restore(flags);
+}
+#else
+void latency_stat(){
+    printf("latency_stat: SCHED_LATENCY is disabled\n");
+}
+
+void latency_reset(){
+}
+#endif
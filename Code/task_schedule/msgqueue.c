@@ -0,0 +1,132 @@
+#include "task_schedule.h"
+
+/*
+ * 消息队列
+ *
+ * 消息是一个指针，发送者把缓冲区的所有权交给接收者，数据本身不拷贝。
+ * 队列的存储是创建时一次性分配的固定大小的环形缓冲区，收发过程中不再分配内存。
+ * 有接收者等待时，发送者把消息通过wait_data直接交给它并唤醒，
+ * 一次消息传递只需要接收者被调度一次。
+ */
+
+/*
+ * 描述：
+ * 创建消息队列
+ * - capacity：环形缓冲区能容纳的消息数，至少为1
+ * 返回值：
+ * 消息队列，失败时返回NULL
+ */
+struct msgqueue *mq_create(int capacity){
+    if(capacity <= 0){
+        return NULL;
+    }
+    struct msgqueue *mq = (struct msgqueue *)malloc(sizeof(struct msgqueue)
+                                                    + capacity * sizeof(void *));
+    if(mq == NULL){
+        return NULL;
+    }
+    spin_init(&mq->lock);
+    mq->capacity = capacity;
+    mq->head = 0;
+    mq->count = 0;
+    wait_queue_init(&mq->send_wq, WQ_PRIO);
+    wait_queue_init(&mq->recv_wq, WQ_PRIO);
+    return mq;
+}
+
+/*
+ * 描述：
+ * 删除消息队列，队列中尚未接收的消息由调用者负责处理
+ * 返回值：
+ * 0：成功
+ * -1：仍有任务在等待该队列
+ */
+int mq_delete(struct msgqueue *mq){
+    reg_t flags = irq_save();
+    spin_lock(&mq->lock);
+    int busy = mq->send_wq.head != NULL || mq->recv_wq.head != NULL;
+    spin_unlock(&mq->lock);
+    irq_restore(flags);
+    if(busy){
+        return -1;
+    }
+    free(mq);
+    return 0;
+}
+
+/*
+ * 描述：
+ * 发送一条消息，缓冲区满时最多等待timeout个时间片
+ * - msg：消息，发送成功后其指向的缓冲区归接收者所有
+ * - timeout：超时的时间片数，0表示不等待，WAIT_FOREVER表示一直等待
+ * 返回值：
+ * 0：成功
+ * -1：超时（或timeout为0时缓冲区已满），msg仍归发送者所有
+ */
+int mq_send(struct msgqueue *mq, void *msg, uint64_t timeout){
+    int ret = 0;
+    reg_t flags = irq_save();
+    spin_lock(&mq->lock);
+
+    /* 有接收者等待时缓冲区一定为空，直接交给接收者 */
+    struct Task *receiver = wait_queue_pop(&mq->recv_wq);
+    if(receiver != NULL){
+        receiver->wait_data = msg;
+        task_wakeup(receiver);
+        spin_unlock(&mq->lock);
+    }else if(mq->count < mq->capacity){
+        mq->slots[(mq->head + mq->count) % mq->capacity] = msg;
+        mq->count++;
+        spin_unlock(&mq->lock);
+    }else if(timeout == 0){
+        spin_unlock(&mq->lock);
+        ret = -1;
+    }else{
+        /* 消息由mq_recv()补入缓冲区后才会唤醒 */
+        task_self()->wait_data = msg;
+        ret = wait_queue_sleep_timeout(&mq->send_wq, &mq->lock, timeout);
+    }
+    irq_restore(flags);
+    return ret;
+}
+
+/*
+ * 描述：
+ * 接收一条消息，队列为空时最多等待timeout个时间片
+ * - msg：用于返回消息，接收成功后其指向的缓冲区归调用者所有
+ * - timeout：超时的时间片数，0表示不等待，WAIT_FOREVER表示一直等待
+ * 返回值：
+ * 0：成功
+ * -1：超时（或timeout为0时队列为空）
+ */
+int mq_recv(struct msgqueue *mq, void **msg, uint64_t timeout){
+    int ret = 0;
+    reg_t flags = irq_save();
+    spin_lock(&mq->lock);
+
+    if(mq->count > 0){
+        *msg = mq->slots[mq->head];
+        mq->head = (mq->head + 1) % mq->capacity;
+        mq->count--;
+        /* 空出一个位置，补入等待中的发送者的消息 */
+        struct Task *sender = wait_queue_pop(&mq->send_wq);
+        if(sender != NULL){
+            mq->slots[(mq->head + mq->count) % mq->capacity] = sender->wait_data;
+            mq->count++;
+            task_wakeup(sender);
+        }
+        spin_unlock(&mq->lock);
+    }else if(timeout == 0){
+        spin_unlock(&mq->lock);
+        ret = -1;
+    }else{
+        /* mq_send()通过wait_data把消息交给当前任务后才会唤醒 */
+        struct Task *self = task_self();
+        ret = wait_queue_sleep_timeout(&mq->recv_wq, &mq->lock, timeout);
+        if(ret == 0){
+            *msg = self->wait_data;
+        }
+    }
+    irq_restore(flags);
+    return ret;
+}
@@ -0,0 +1,211 @@
+#include "task_schedule.h"
+
+/*
+ * 任务通知
+ *
+ * 每个任务的任务控制块中有一个32位的通知值，其它任务或中断处理函数直接向某个任务发出通知，
+ * 不需要创建信号量、事件组等对象，也没有等待队列：
+ * 等待者只能是任务自己，发出通知时只需检查notify_waiting并唤醒它。
+ * 通知值的字段由任务自己的notify_lock保护，
+ * 唤醒在持有notify_lock时进行，等待者超时返回后不会再被这次通知唤醒。
+ * 加锁顺序为 notify_lock -> 定时器轮的锁 -> 就绪队列的锁
+ */
+
+/*
+ * 当前任务等待通知，最多等待timeout个时间片
+ * 调用者需关闭中断并持有self->notify_lock，返回时仍然持有
+ * 返回后由调用者根据notify_pending判断是否收到了通知
+ */
+static void notify_block(struct Task *self, uint64_t timeout){
+    self->notify_waiting = 1;
+    task_prepare_block();
+    if(timeout != WAIT_FOREVER){
+        timer_wheel_add(self, timer_get_tick() + timeout);
+    }
+    task_block(&self->notify_lock);
+    if(timeout != WAIT_FOREVER){
+        timer_wheel_del(self);
+    }
+    spin_lock(&self->notify_lock);
+    self->notify_waiting = 0;
+}
+
+/*
+ * 描述：
+ * 向任务发出通知，任务正在等待通知时唤醒它
+ * 不会阻塞，可以在中断处理函数中调用
+ * - value：与action配合修改通知值
+ * - action：NOTIFY_NONE等，见sync.h
+ * 返回值：
+ * 0：成功
+ * -1：action为NOTIFY_NO_OVERWRITE且上一个通知尚未被取走
+ */
+int task_notify(struct Task *task, uint32_t value, int action){
+    int ret = 0;
+    reg_t flags = irq_save();
+    spin_lock(&task->notify_lock);
+    switch(action){
+    case NOTIFY_INCREMENT:
+        task->notify_value++;
+        break;
+    case NOTIFY_SET_BITS:
+        task->notify_value |= value;
+        break;
+    case NOTIFY_OVERWRITE:
+        task->notify_value = value;
+        break;
+    case NOTIFY_NO_OVERWRITE:
+        if(task->notify_pending){
+            ret = -1;
+        }else{
+            task->notify_value = value;
+        }
+        break;
+    default:
+        break;
+    }
+    if(ret == 0){
+        task->notify_pending = 1;
+        if(task->notify_waiting){
+            task->notify_waiting = 0;
+            task_wakeup(task);
+        }
+    }
+    spin_unlock(&task->notify_lock);
+    irq_restore(flags);
+    return ret;
+}
+
+/* 通知值加1，与notify_take()配合使用，可以在中断处理函数中调用 */
+void task_notify_give(struct Task *task){
+    task_notify(task, 0, NOTIFY_INCREMENT);
+}
+
+/*
+ * 描述：
+ * 把当前任务的通知值作为计数信号量取走，通知值为0时最多等待timeout个时间片
+ * - clear：为0时通知值减1，否则清0
+ * - timeout：超时的时间片数，0表示不等待，WAIT_FOREVER表示一直等待
+ * 返回值：
+ * 取走之前的通知值，超时时为0
+ */
+uint32_t notify_take(int clear, uint64_t timeout){
+    struct Task *self = task_self();
+    reg_t flags = irq_save();
+    spin_lock(&self->notify_lock);
+    if(self->notify_value == 0 && timeout != 0){
+        notify_block(self, timeout);
+    }
+    uint32_t value = self->notify_value;
+    if(value != 0){
+        self->notify_value = clear ? 0 : value - 1;
+    }
+    self->notify_pending = 0;
+    spin_unlock(&self->notify_lock);
+    irq_restore(flags);
+    return value;
+}
+
+/*
+ * 描述：
+ * 等待当前任务的下一个通知，最多等待timeout个时间片
+ * - clear_on_entry：没有待取的通知时，在等待之前清除通知值中的这些位
+ * - clear_on_exit：收到通知时，在返回之前清除通知值中的这些位
+ * - value：不为NULL时返回收到通知时（清除之前）的通知值
+ * - timeout：超时的时间片数，0表示不等待，WAIT_FOREVER表示一直等待
+ * 返回值：
+ * 0：收到通知
+ * -1：超时（或timeout为0时没有待取的通知）
+ */
+int notify_wait(uint32_t clear_on_entry, uint32_t clear_on_exit,
+                uint32_t *value, uint64_t timeout){
+    int ret = 0;
+    struct Task *self = task_self();
+    reg_t flags = irq_save();
+    spin_lock(&self->notify_lock);
+    if(!self->notify_pending){
+        self->notify_value &= ~clear_on_entry;
+        if(timeout != 0){
+            notify_block(self, timeout);
+        }
+    }
+    if(value != NULL){
+        *value = self->notify_value;
+    }
+    if(self->notify_pending){
+        self->notify_value &= ~clear_on_exit;
+        self->notify_pending = 0;
+    }else{
+        ret = -1;
+    }
+    spin_unlock(&self->notify_lock);
+    irq_restore(flags);
+    return ret;
+}
+
+/*
+ * 唤醒路径的性能测试
+ * 两个任务来回唤醒对方NOTIFY_BENCH_ROUNDS次，
+ * 分别使用任务通知与信号量，打印每个来回平均消耗的mcycle周期数
+ * 需要在任务中调用，等待期间调用者睡眠
+ */
+#define NOTIFY_BENCH_ROUNDS 1000
+#define NOTIFY_BENCH_PRIO   1
+
+static struct Task *volatile bench_ping;
+static struct Task *volatile bench_pong;
+static struct semaphore bench_sem_ping;
+static struct semaphore bench_sem_pong;
+static int bench_use_sem;
+static volatile reg_t bench_cycles;
+static volatile int bench_done;
+
+static void bench_pong_task(void *param){
+    for(int i = 0;i < NOTIFY_BENCH_ROUNDS;i++){
+        if(bench_use_sem){
+            sem_wait(&bench_sem_pong);
+            sem_post(&bench_sem_ping);
+        }else{
+            notify_take(0, WAIT_FOREVER);
+            task_notify_give(bench_ping);
+        }
+    }
+}
+
+static void bench_ping_task(void *param){
+    bench_ping = task_self();
+    reg_t start = r_mcycle();
+    for(int i = 0;i < NOTIFY_BENCH_ROUNDS;i++){
+        if(bench_use_sem){
+            sem_post(&bench_sem_pong);
+            sem_wait(&bench_sem_ping);
+        }else{
+            task_notify_give(bench_pong);
+            notify_take(0, WAIT_FOREVER);
+        }
+    }
+    bench_cycles = (r_mcycle() - start) / NOTIFY_BENCH_ROUNDS;
+    bench_done = 1;
+}
+
+/* 运行一轮测试，返回每个来回的周期数，创建任务失败时返回0 */
+static reg_t notify_bench_run(int use_sem){
+    bench_use_sem = use_sem;
+    bench_done = 0;
+    sem_init(&bench_sem_ping, 0, WQ_FIFO);
+    sem_init(&bench_sem_pong, 0, WQ_FIFO);
+    bench_pong = task_create(bench_pong_task, NULL, NOTIFY_BENCH_PRIO, 0);
+    if(bench_pong == NULL || task_create(bench_ping_task, NULL, NOTIFY_BENCH_PRIO, 0) == NULL){
+        return 0;
+    }
+    while(!bench_done){
+        task_sleep_us(10000);
+    }
+    return bench_cycles;
+}
+
+void notify_bench(){
+    reg_t notify = notify_bench_run(0);
+    reg_t sem = notify_bench_run(1);
+    printf("wakeup round trip: notify: %ld cycles, semaphore: %ld cycles\n", notify, sem);
+}
@@ -0,0 +1,293 @@
+#include "task_schedule.h"
+
+/*
+ * 无栈轻量任务的执行器，宏与struct pt见pt.h
+ *
+ * 执行器是一个普通的任务，依次调用就绪队列中的轻量任务的例程，
+ * 所有轻量任务共用执行器的栈。
+ * 睡眠的轻量任务挂入执行器私有的哈希定时器轮（与sleep.c相同的结构），
+ * 执行器在没有就绪的轻量任务时在自己的等待队列上睡眠，最多睡到最早的到期时间，
+ * pt_wake()与pt_spawn()把轻量任务放入就绪队列并唤醒执行器。
+ * 执行器的锁保护就绪队列、定时器轮与各轻量任务的state/flags，
+ * 调用轻量任务的例程时不持有锁
+ */
+
+/* 定时器轮的槽数，必须是2的幂 */
+#define PT_WHEEL_SIZE 64
+
+/* 轻量任务的状态 */
+#define PT_S_READY    0
+#define PT_S_RUNNING  1
+#define PT_S_WAITING  2
+#define PT_S_SLEEPING 3
+
+/*
+ * 不在等待时被pt_wake()唤醒（就绪、运行或睡眠中），唤醒被记录下来，
+ * 下一次返回PT_WAITING时直接放回就绪队列并清除，PT_WAIT()立即返回
+ */
+#define PT_F_WOKEN 1
+
+/*
+ * ready_head/ready_tail：就绪队列，FIFO
+ * wheel：睡眠的轻量任务，到期时间为wake的挂在wheel[wake % PT_WHEEL_SIZE]中
+ * wheel_tick：定时器轮已经处理到的时间片计数（低32位）
+ * wq：执行器没有就绪的轻量任务时在此等待
+ */
+struct pt_executor {
+	struct spinlock lock;
+	struct pt *ready_head;
+	struct pt *ready_tail;
+	struct pt *wheel[PT_WHEEL_SIZE];
+	uint32_t wheel_tick;
+	uint32_t nr_sleeping;
+	uint32_t nr_tasks;
+	struct wait_queue wq;
+	uint64_t nr_runs;
+};
+
+/* 放入就绪队列队尾并唤醒执行器，调用者需持有执行器的锁 */
+static void pt_enqueue(struct pt_executor *ex, struct pt *pt){
+    pt->state = PT_S_READY;
+    pt->next = NULL;
+    if(ex->ready_tail == NULL){
+        ex->ready_head = pt;
+    }else{
+        ex->ready_tail->next = pt;
+    }
+    ex->ready_tail = pt;
+    wait_queue_wake_one(&ex->wq);
+}
+
+/* 挂入定时器轮，pt->wake为睡眠的时间片数，调用者需持有执行器的锁 */
+static void pt_sleep(struct pt_executor *ex, struct pt *pt){
+    uint32_t ticks = pt->wake == 0 ? 1 : pt->wake;
+    pt->wake = ex->wheel_tick + ticks;
+    pt->state = PT_S_SLEEPING;
+    struct pt **slot = &ex->wheel[pt->wake & (PT_WHEEL_SIZE - 1)];
+    pt->next = *slot;
+    *slot = pt;
+    ex->nr_sleeping++;
+}
+
+/*
+ * 把到期的轻量任务移入就绪队列，调用者需持有执行器的锁
+ * 若错过了若干个时间片，依次补上，但最多检查一整圈
+ */
+static void pt_expire(struct pt_executor *ex, uint32_t now){
+    uint32_t n = now - ex->wheel_tick;
+    if(n == 0 || ex->nr_sleeping == 0){
+        ex->wheel_tick = now;
+        return;
+    }
+    if(n > PT_WHEEL_SIZE){
+        n = PT_WHEEL_SIZE;
+    }
+    for(uint32_t i = 1;i <= n;i++){
+        struct pt **pos = &ex->wheel[(ex->wheel_tick + i) & (PT_WHEEL_SIZE - 1)];
+        while(*pos != NULL){
+            struct pt *pt = *pos;
+            if((int)(now - pt->wake) >= 0){
+                *pos = pt->next;
+                ex->nr_sleeping--;
+                pt_enqueue(ex, pt);
+            }else{
+                pos = &pt->next;
+            }
+        }
+    }
+    ex->wheel_tick = now;
+}
+
+/* 返回距离定时器轮中最早的到期时间的时间片数，最多一整圈 */
+static uint64_t pt_next_timeout(struct pt_executor *ex){
+    for(uint32_t i = 1;i <= PT_WHEEL_SIZE;i++){
+        struct pt *pt = ex->wheel[(ex->wheel_tick + i) & (PT_WHEEL_SIZE - 1)];
+        for(;pt != NULL;pt = pt->next){
+            if(pt->wake == ex->wheel_tick + i){
+                return i;
+            }
+        }
+    }
+    return PT_WHEEL_SIZE;
+}
+
+/* 执行器任务的例程 */
+static void pt_executor_main(void *param){
+    struct pt_executor *ex = (struct pt_executor *)param;
+    reg_t flags = irq_save();
+    spin_lock(&ex->lock);
+    while(1){
+        pt_expire(ex, (uint32_t)timer_get_tick());
+        struct pt *pt = ex->ready_head;
+        if(pt == NULL){
+            uint64_t timeout = ex->nr_sleeping ? pt_next_timeout(ex) : WAIT_FOREVER;
+            wait_queue_sleep_timeout(&ex->wq, &ex->lock, timeout);
+            spin_lock(&ex->lock);
+            continue;
+        }
+        ex->ready_head = pt->next;
+        if(ex->ready_head == NULL){
+            ex->ready_tail = NULL;
+        }
+        pt->state = PT_S_RUNNING;
+        spin_unlock(&ex->lock);
+        irq_restore(flags);
+
+        int ret = pt->fn(pt);
+
+        flags = irq_save();
+        spin_lock(&ex->lock);
+        ex->nr_runs++;
+        switch(ret){
+        case PT_YIELDED:
+            pt_enqueue(ex, pt);
+            break;
+        case PT_WAITING:
+            if(pt->flags & PT_F_WOKEN){
+                pt->flags &= ~PT_F_WOKEN;
+                pt_enqueue(ex, pt);
+            }else{
+                pt->state = PT_S_WAITING;
+            }
+            break;
+        case PT_SLEEPING:
+            pt_sleep(ex, pt);
+            break;
+        default:
+            /* 轻量任务已经结束，可能已被释放，不再访问 */
+            ex->nr_tasks--;
+            break;
+        }
+    }
+}
+
+/*
+ * 描述：
+ * 创建执行器，执行器是一个按照priority调度的普通任务
+ * - stack_size：执行器任务的栈大小，同task_create()，所有轻量任务共用这个栈
+ * 返回值：
+ * 执行器，失败时返回NULL
+ */
+struct pt_executor *pt_executor_create(uint8_t priority, uint32_t stack_size){
+    struct pt_executor *ex = (struct pt_executor *)malloc(sizeof(struct pt_executor));
+    if(ex == NULL){
+        return NULL;
+    }
+    spin_init(&ex->lock);
+    ex->ready_head = NULL;
+    ex->ready_tail = NULL;
+    for(int i = 0;i < PT_WHEEL_SIZE;i++){
+        ex->wheel[i] = NULL;
+    }
+    ex->wheel_tick = (uint32_t)timer_get_tick();
+    ex->nr_sleeping = 0;
+    ex->nr_tasks = 0;
+    wait_queue_init(&ex->wq, WQ_FIFO);
+    ex->nr_runs = 0;
+    if(task_create(pt_executor_main, ex, priority, stack_size) == NULL){
+        free(ex);
+        return NULL;
+    }
+    return ex;
+}
+
+/*
+ * 描述：
+ * 在执行器中启动一个轻量任务，可以在任何任务中调用
+ * - pt：轻量任务，由调用者分配，结束之前不能释放
+ * - fn：例程，用PT_BEGIN()/PT_END()包围
+ */
+void pt_spawn(struct pt_executor *ex, struct pt *pt, int (*fn)(struct pt *pt)){
+    pt->fn = fn;
+    pt->ex = ex;
+    pt->lc = 0;
+    pt->flags = 0;
+    pt->wake = 0;
+    reg_t flags = irq_save();
+    spin_lock(&ex->lock);
+    ex->nr_tasks++;
+    pt_enqueue(ex, pt);
+    spin_unlock(&ex->lock);
+    irq_restore(flags);
+}
+
+/*
+ * 描述：
+ * 唤醒在PT_WAIT()处等待的轻量任务，不会阻塞，可以在中断处理函数中调用
+ * 轻量任务没有在等待（就绪、运行或睡眠）时记录这次唤醒，
+ * 它随后的第一个PT_WAIT()立即返回，唤醒不会丢失，多次唤醒只记录一次
+ * 返回值：
+ * 1：轻量任务正在等待，已放入就绪队列
+ * 0：唤醒已被记录
+ */
+int pt_wake(struct pt *pt){
+    struct pt_executor *ex = pt->ex;
+    int woken = 0;
+    reg_t flags = irq_save();
+    spin_lock(&ex->lock);
+    if(pt->state == PT_S_WAITING){
+        pt_enqueue(ex, pt);
+        woken = 1;
+    }else{
+        pt->flags |= PT_F_WOKEN;
+    }
+    spin_unlock(&ex->lock);
+    irq_restore(flags);
+    return woken;
+}
+
+/*
+ * 轻量任务的性能测试
+ * 创建n个轻量任务，每个让出执行器PT_BENCH_ROUNDS次后睡眠一个时间片再结束，
+ * 打印占用的内存以及每次恢复轻量任务平均消耗的mcycle周期数
+ * 需要在任务中调用，等待期间调用者睡眠
+ */
+#define PT_BENCH_ROUNDS 10
+
+struct pt_bench_item {
+	struct pt pt;
+	uint32_t i;
+};
+
+static struct pt_executor *pt_bench_ex = NULL;
+static volatile uint32_t pt_bench_left;
+static volatile reg_t pt_bench_end;
+
+static int pt_bench_fn(struct pt *pt){
+    struct pt_bench_item *item = (struct pt_bench_item *)pt;
+    PT_BEGIN(pt);
+    for(item->i = 0;item->i < PT_BENCH_ROUNDS;item->i++){
+        PT_YIELD(pt);
+    }
+    if(__sync_sub_and_fetch(&pt_bench_left, 1) == 0){
+        pt_bench_end = r_mcycle();
+    }
+    PT_SLEEP(pt, 1);
+    PT_END(pt);
+}
+
+void pt_bench(int n){
+    /* 执行器在多次测试之间复用 */
+    if(pt_bench_ex == NULL){
+        pt_bench_ex = pt_executor_create(Priority_num - 2, 0);
+    }
+    struct pt_executor *ex = pt_bench_ex;
+    struct pt_bench_item *items = (struct pt_bench_item *)malloc(n * sizeof(struct pt_bench_item));
+    if(ex == NULL || items == NULL){
+        printf("pt_bench: out of memory\n");
+        free(items);
+        return;
+    }
+    pt_bench_left = n;
+    reg_t start = r_mcycle();
+    for(int i = 0;i < n;i++){
+        pt_spawn(ex, &items[i].pt, pt_bench_fn);
+    }
+    while(pt_bench_left != 0 || ex->nr_tasks != 0){
+        task_sleep_us(10000);
+    }
+    printf("protothreads: %d, memory: %ld bytes (%ld per task), resume: %ld cycles\n",
+           n, n * sizeof(struct pt_bench_item), sizeof(struct pt_bench_item),
+           (pt_bench_end - start) / ((reg_t)n * (PT_BENCH_ROUNDS + 1)));
+    free(items);
+}
@@ -0,0 +1,172 @@
+#include "task_schedule.h"
+
+/*
+ * 基于时间片计数的任务睡眠
+ *
+ * 睡眠的任务离开就绪队列，挂入一个哈希定时器轮（hashed timer wheel）：
+ * 定时器轮有WHEEL_SIZE个槽，到期时间为expire_tick的任务挂在
+ * wheel[expire_tick % WHEEL_SIZE]中，插入与删除均为O(1)。
+ * hart 0的定时器中断每个时间片只检查当前时间片对应的一个槽，
+ * 唤醒其中已经到期的任务，不到期的任务（需要再转若干圈）留在槽中。
+ */
+
+/* 定时器轮的槽数，必须是2的幂 */
+#define WHEEL_SIZE 64
+
+/*
+ * wheel：定时器轮的各个槽，每个槽是由timer_front/timer_next组成的双向链表
+ * wheel_tick：定时器轮已经处理到的时间片计数
+ * wheel_lock：保护定时器轮，加锁顺序为 wheel_lock -> 就绪队列的锁
+ */
+#pragma pack (8)
+static struct Task *wheel[WHEEL_SIZE];
+static uint64_t wheel_tick = 0;
+static struct spinlock wheel_lock;
+#pragma pack ()
+
+/* 将任务从其所在的槽中移除，调用者需持有wheel_lock */
+static void wheel_unlink(struct Task *task){
+    struct Task **slot = &wheel[task->expire_tick & (WHEEL_SIZE - 1)];
+    if(task->timer_front == NULL){
+        *slot = task->timer_next;
+    }else{
+        task->timer_front->timer_next = task->timer_next;
+    }
+    if(task->timer_next != NULL){
+        task->timer_next->timer_front = task->timer_front;
+    }
+    task->timer_front = NULL;
+    task->timer_next = NULL;
+    task->expire_tick = 0;
+}
+
+/*
+ * 将任务挂入定时器轮，到期时由定时器中断调用task_wakeup()唤醒
+ * - task：要定时唤醒的任务
+ * - expire_tick：到期的时间片计数
+ */
+void timer_wheel_add(struct Task *task, uint64_t expire_tick){
+    reg_t flags = irq_save();
+    spin_lock(&wheel_lock);
+    /* 已经处理过的时间片不会再被检查，至少推迟到下一个时间片 */
+    if(expire_tick <= wheel_tick){
+        expire_tick = wheel_tick + 1;
+    }
+    task->expire_tick = expire_tick;
+
+    struct Task **slot = &wheel[expire_tick & (WHEEL_SIZE - 1)];
+    task->timer_front = NULL;
+    task->timer_next = *slot;
+    if(*slot != NULL){
+        (*slot)->timer_front = task;
+    }
+    *slot = task;
+    spin_unlock(&wheel_lock);
+    /* hart 0空闲时可能没有装载定时器，通知其重新计算下一个期限 */
+    sched_kick(0);
+    irq_restore(flags);
+}
+
+/*
+ * 将任务从定时器轮中移除
+ * 返回值：
+ * 1：任务在定时器轮中（定时器尚未到期）
+ * 0：任务不在定时器轮中（定时器已经到期或从未加入）
+ */
+int timer_wheel_del(struct Task *task){
+    int pending = 0;
+    reg_t flags = irq_save();
+    spin_lock(&wheel_lock);
+    if(task->expire_tick != 0){
+        wheel_unlink(task);
+        pending = 1;
+    }
+    spin_unlock(&wheel_lock);
+    irq_restore(flags);
+    return pending;
+}
+
+/*
+ * 由hart 0的定时器中断调用（此时中断关闭），唤醒所有到期的任务
+ * - now：当前的时间片计数
+ * 若错过了若干个时间片，依次补上，但最多检查一整圈
+ */
+void timer_wheel_expire(uint64_t now){
+    spin_lock(&wheel_lock);
+    uint64_t n = now - wheel_tick;
+    if(n > WHEEL_SIZE){
+        n = WHEEL_SIZE;
+    }
+    for(uint64_t i = 1;i <= n;i++){
+        struct Task *task = wheel[(wheel_tick + i) & (WHEEL_SIZE - 1)];
+        while(task != NULL){
+            struct Task *next = task->timer_next;
+            if(task->expire_tick <= now){
+                wheel_unlink(task);
+                task_wakeup(task);
+            }
+            task = next;
+        }
+    }
+    wheel_tick = now;
+    spin_unlock(&wheel_lock);
+}
+
+/*
+ * 返回定时器轮中最早的到期时间，供hart 0空闲时装载定时器
+ * 最多只检查一整圈：到期时间在一圈之内的任务一定位于其到期时间对应的槽中，
+ * 一圈之内没有到期的任务时返回一圈之后的时间片，届时再重新计算
+ * 返回值：
+ * 到期的时间片计数，定时器轮为空时返回0
+ */
+uint64_t timer_wheel_next(){
+    uint64_t next = 0;
+    int empty = 1;
+    reg_t flags = irq_save();
+    spin_lock(&wheel_lock);
+    for(uint64_t i = 1;i <= WHEEL_SIZE;i++){
+        struct Task *task = wheel[(wheel_tick + i) & (WHEEL_SIZE - 1)];
+        for(;task != NULL;task = task->timer_next){
+            empty = 0;
+            if(task->expire_tick == wheel_tick + i){
+                next = task->expire_tick;
+                break;
+            }
+        }
+        if(next != 0){
+            break;
+        }
+    }
+    if(next == 0 && !empty){
+        next = wheel_tick + WHEEL_SIZE;
+    }
+    spin_unlock(&wheel_lock);
+    irq_restore(flags);
+    return next;
+}
+
+/*
+ * 描述：
+ * 当前任务睡眠ticks个时间片，睡眠期间不占用CPU
+ * 唤醒精度为一个时间片
+ * - ticks：睡眠的时间片数，为0时相当于task_yield()
+ */
+void task_sleep(uint64_t ticks){
+    if(ticks == 0){
+        task_yield();
+        return;
+    }
+    reg_t flags = irq_save();
+    task_prepare_block();
+    timer_wheel_add(task_self(), timer_get_tick() + ticks);
+    task_block(NULL);
+    irq_restore(flags);
+}
+
+/*
+ * 描述：
+ * 当前任务睡眠至少us微秒，向上取整到时间片
+ */
+void task_sleep_us(uint64_t us){
+    task_sleep(timer_us_to_tick(us));
+}
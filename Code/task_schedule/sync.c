@@ -0,0 +1,413 @@
+#include "task_schedule.h"
+
+/*
+ * 任务间的同步原语：互斥锁、信号量与条件变量
+ *
+ * 每个对象有自己的自旋锁与等待队列，需要等待的任务离开就绪队列，
+ * 挂入对象的等待队列，直到被唤醒才重新参与调度。
+ * 释放互斥锁与信号量时直接把所有权交给被唤醒的任务，
+ * 被唤醒的任务返回时已经获得了资源，不需要再次竞争。
+ * 加锁顺序为 对象的锁 -> pi_lock -> 就绪队列的锁
+ */
+
+/*
+ * pi_lock：保护所有任务的held_mutex链表以及因优先级继承而进行的优先级修改
+ * 同一时刻只有持有一个互斥锁的对象锁时才会获取它
+ */
+static struct spinlock pi_lock;
+
+void wait_queue_init(struct wait_queue *wq, uint8_t order){
+    wq->head = NULL;
+    wq->order = order;
+}
+
+/* 将任务插入等待队列，调用者需持有等待队列所属对象的锁 */
+static void wait_queue_insert(struct wait_queue *wq, struct Task *task){
+    struct Task **pos = &wq->head;
+    if(wq->order == WQ_PRIO){
+        /* 插在所有优先级不低于它的任务之后，同优先级保持FIFO */
+        while(*pos != NULL && (*pos)->priority <= task->priority){
+            pos = &(*pos)->wait_next;
+        }
+    }else{
+        while(*pos != NULL){
+            pos = &(*pos)->wait_next;
+        }
+    }
+    task->wait_next = *pos;
+    task->wait_on = wq;
+    *pos = task;
+}
+
+/*
+ * 当前任务在等待队列上睡眠，直到被wait_queue_wake_one()等唤醒
+ * - wq：等待队列
+ * - lk：保护等待队列的锁，任务离开就绪队列后才释放，返回时不再持有
+ * 调用者需关闭中断并持有lk，任务被唤醒后返回，中断仍然关闭
+ */
+void wait_queue_sleep(struct wait_queue *wq, struct spinlock *lk){
+    struct Task *self = task_self();
+    task_prepare_block();
+    wait_queue_insert(wq, self);
+    task_block(lk);
+}
+
+/* 将任务从等待队列中移除，调用者需持有等待队列所属对象的锁 */
+static void wait_queue_remove(struct wait_queue *wq, struct Task *task){
+    struct Task **pos = &wq->head;
+    while(*pos != task){
+        pos = &(*pos)->wait_next;
+    }
+    *pos = task->wait_next;
+    task->wait_next = NULL;
+    task->wait_on = NULL;
+}
+
+/*
+ * 当前任务在等待队列上睡眠，最多等待timeout个时间片
+ * 同时挂入定时器轮，被唤醒后根据任务是否仍在等待队列中判断结果：
+ * 唤醒者总是先把任务从等待队列中取出再唤醒，
+ * 因此即使超时与唤醒同时发生，只要已经被取出，就按成功处理，
+ * 唤醒者交给任务的资源不会丢失
+ * - wq：等待队列
+ * - lk：保护等待队列的锁，返回时不再持有
+ * - timeout：超时的时间片数，WAIT_FOREVER表示一直等待
+ * 调用者需关闭中断并持有lk，返回时中断仍然关闭
+ * 返回值：
+ * 0：被唤醒
+ * -1：超时
+ */
+int wait_queue_sleep_timeout(struct wait_queue *wq, struct spinlock *lk,
+                             uint64_t timeout){
+    if(timeout == WAIT_FOREVER){
+        wait_queue_sleep(wq, lk);
+        return 0;
+    }
+    struct Task *self = task_self();
+    task_prepare_block();
+    wait_queue_insert(wq, self);
+    timer_wheel_add(self, timer_get_tick() + timeout);
+    task_block(lk);
+
+    /* 定时器轮中的唤醒完成之后timer_wheel_del()才返回，不会留下过期的唤醒 */
+    timer_wheel_del(self);
+
+    int ret = 0;
+    spin_lock(lk);
+    if(self->wait_on == wq){
+        wait_queue_remove(wq, self);
+        ret = -1;
+    }
+    spin_unlock(lk);
+    return ret;
+}
+
+/*
+ * 取出等待队列的队首任务，但不唤醒它
+ * 调用者需持有等待队列所属对象的锁
+ * 返回值：
+ * 队首任务，队列为空时返回NULL
+ */
+struct Task *wait_queue_pop(struct wait_queue *wq){
+    struct Task *task = wq->head;
+    if(task != NULL){
+        wq->head = task->wait_next;
+        task->wait_next = NULL;
+        task->wait_on = NULL;
+    }
+    return task;
+}
+
+/*
+ * 唤醒等待队列的队首任务，调用者需持有等待队列所属对象的锁
+ * 返回值：
+ * 1：唤醒了一个任务
+ * 0：等待队列为空
+ */
+int wait_queue_wake_one(struct wait_queue *wq){
+    struct Task *task = wait_queue_pop(wq);
+    if(task == NULL){
+        return 0;
+    }
+    task_wakeup(task);
+    return 1;
+}
+
+/*
+ * 唤醒等待队列中的所有任务，调用者需持有等待队列所属对象的锁
+ * 返回值：
+ * 被唤醒的任务数
+ */
+int wait_queue_wake_all(struct wait_queue *wq){
+    int n = 0;
+    while(wait_queue_wake_one(wq)){
+        n++;
+    }
+    return n;
+}
+
+void mutex_init(struct mutex *m){
+    spin_init(&m->lock);
+    m->owner = NULL;
+    wait_queue_init(&m->wq, WQ_PRIO);
+    m->held_next = NULL;
+}
+
+/* 将互斥锁记为task持有，调用者需持有pi_lock */
+static void mutex_hold(struct mutex *m, struct Task *task){
+    m->owner = task;
+    m->held_next = task->held_mutex;
+    task->held_mutex = m;
+}
+
+/* 将互斥锁从持有者的链表中移除，调用者需持有pi_lock */
+static void mutex_release(struct mutex *m){
+    struct mutex **pos = &m->owner->held_mutex;
+    while(*pos != m){
+        pos = &(*pos)->held_next;
+    }
+    *pos = m->held_next;
+    m->held_next = NULL;
+    m->owner = NULL;
+}
+
+/*
+ * 重新计算任务应有的优先级：base_priority与其持有的各互斥锁中
+ * 优先级最高的等待者取较高者（数值较小者）
+ * 调用者需持有pi_lock
+ */
+static void mutex_update_priority(struct Task *task){
+    uint8_t prio = task->base_priority;
+    for(struct mutex *m = task->held_mutex;m != NULL;m = m->held_next){
+        /* 等待队列按优先级排序，队首即为优先级最高的等待者 */
+        struct Task *waiter = m->wq.head;
+        if(waiter != NULL && waiter->priority < prio){
+            prio = waiter->priority;
+        }
+    }
+    task_set_priority(task, prio);
+}
+
+/*
+ * 描述：
+ * 获取互斥锁，互斥锁已被持有时阻塞，直到持有者将其交给当前任务
+ * 阻塞前将持有者的优先级提升到当前任务的优先级（优先级继承）
+ * 只继承一层：持有者自己阻塞在其它互斥锁上时，不会继续提升那个互斥锁的持有者
+ * 返回值：
+ * 0：成功获取
+ * -1：当前任务已经持有该互斥锁
+ */
+int mutex_lock(struct mutex *m){
+    reg_t flags = irq_save();
+    struct Task *self = task_self();
+    spin_lock(&m->lock);
+    if(m->owner == self){
+        spin_unlock(&m->lock);
+        irq_restore(flags);
+        return -1;
+    }
+    if(m->owner == NULL){
+        spin_lock(&pi_lock);
+        mutex_hold(m, self);
+        spin_unlock(&pi_lock);
+        spin_unlock(&m->lock);
+        irq_restore(flags);
+        return 0;
+    }
+
+    spin_lock(&pi_lock);
+    if(self->priority < m->owner->priority){
+        task_set_priority(m->owner, self->priority);
+    }
+    spin_unlock(&pi_lock);
+
+    /* mutex_unlock()把互斥锁交给当前任务之后才会唤醒 */
+    wait_queue_sleep(&m->wq, &m->lock);
+    irq_restore(flags);
+    return 0;
+}
+
+/*
+ * 描述：
+ * 尝试获取互斥锁，不会阻塞
+ * 返回值：
+ * 0：成功获取
+ * -1：互斥锁已被持有
+ */
+int mutex_trylock(struct mutex *m){
+    int ret = -1;
+    reg_t flags = irq_save();
+    struct Task *self = task_self();
+    spin_lock(&m->lock);
+    if(m->owner == NULL){
+        spin_lock(&pi_lock);
+        mutex_hold(m, self);
+        spin_unlock(&pi_lock);
+        ret = 0;
+    }
+    spin_unlock(&m->lock);
+    irq_restore(flags);
+    return ret;
+}
+
+/*
+ * 释放互斥锁，并交给优先级最高的等待者，调用者需关闭中断
+ * 返回值：
+ * 1：当前任务因此失去了继承的优先级
+ * 0：当前任务的优先级没有变化
+ * -1：当前任务没有持有该互斥锁
+ */
+static int __mutex_unlock(struct mutex *m){
+    struct Task *self = task_self();
+    spin_lock(&m->lock);
+    if(m->owner != self){
+        spin_unlock(&m->lock);
+        return -1;
+    }
+    uint8_t prio = self->priority;
+
+    spin_lock(&pi_lock);
+    mutex_release(m);
+    struct Task *next = wait_queue_pop(&m->wq);
+    if(next != NULL){
+        /* 新的持有者继承剩余等待者的优先级 */
+        mutex_hold(m, next);
+        mutex_update_priority(next);
+    }
+    mutex_update_priority(self);
+    spin_unlock(&pi_lock);
+
+    if(next != NULL){
+        task_wakeup(next);
+    }
+    spin_unlock(&m->lock);
+    return self->priority > prio;
+}
+
+/*
+ * 描述：
+ * 释放互斥锁，有任务等待时直接交给优先级最高的等待者
+ * 若当前任务因此失去了继承的优先级，立即让出CPU
+ * 返回值：
+ * 0：成功释放
+ * -1：当前任务没有持有该互斥锁
+ */
+int mutex_unlock(struct mutex *m){
+    reg_t flags = irq_save();
+    int ret = __mutex_unlock(m);
+    irq_restore(flags);
+    if(ret == 1){
+        task_yield();
+    }
+    return ret < 0 ? -1 : 0;
+}
+
+/*
+ * 描述：
+ * 初始化信号量
+ * - count：初始计数
+ * - order：等待队列的排序方式，WQ_FIFO或WQ_PRIO
+ */
+void sem_init(struct semaphore *s, int count, uint8_t order){
+    spin_init(&s->lock);
+    s->count = count;
+    wait_queue_init(&s->wq, order);
+}
+
+/*
+ * 描述：
+ * 计数减1，计数为0时阻塞，直到sem_post()将计数交给当前任务
+ */
+void sem_wait(struct semaphore *s){
+    reg_t flags = irq_save();
+    spin_lock(&s->lock);
+    if(s->count > 0){
+        s->count--;
+        spin_unlock(&s->lock);
+    }else{
+        wait_queue_sleep(&s->wq, &s->lock);
+    }
+    irq_restore(flags);
+}
+
+/*
+ * 描述：
+ * 尝试将计数减1，不会阻塞
+ * 返回值：
+ * 0：成功
+ * -1：计数为0
+ */
+int sem_trywait(struct semaphore *s){
+    int ret = -1;
+    reg_t flags = irq_save();
+    spin_lock(&s->lock);
+    if(s->count > 0){
+        s->count--;
+        ret = 0;
+    }
+    spin_unlock(&s->lock);
+    irq_restore(flags);
+    return ret;
+}
+
+/*
+ * 描述：
+ * 有任务等待时直接唤醒队首的任务，否则计数加1
+ * 不会阻塞，可以在中断处理函数中调用
+ */
+void sem_post(struct semaphore *s){
+    reg_t flags = irq_save();
+    spin_lock(&s->lock);
+    if(!wait_queue_wake_one(&s->wq)){
+        s->count++;
+    }
+    spin_unlock(&s->lock);
+    irq_restore(flags);
+}
+
+/*
+ * 描述：
+ * 初始化条件变量
+ * - order：等待队列的排序方式，WQ_FIFO或WQ_PRIO
+ */
+void cond_init(struct condvar *cv, uint8_t order){
+    spin_init(&cv->lock);
+    wait_queue_init(&cv->wq, order);
+}
+
+/*
+ * 描述：
+ * 释放互斥锁并等待条件变量，被唤醒后重新获取互斥锁再返回
+ * 先挂入等待队列再释放互斥锁，两者之间的cond_signal()不会丢失
+ * 调用者需持有m，被唤醒后应重新检查条件
+ */
+void cond_wait(struct condvar *cv, struct mutex *m){
+    reg_t flags = irq_save();
+    spin_lock(&cv->lock);
+    struct Task *self = task_self();
+    task_prepare_block();
+    wait_queue_insert(&cv->wq, self);
+    __mutex_unlock(m);
+    task_block(&cv->lock);
+    irq_restore(flags);
+
+    mutex_lock(m);
+}
+
+/* 唤醒一个等待条件变量的任务 */
+void cond_signal(struct condvar *cv){
+    reg_t flags = irq_save();
+    spin_lock(&cv->lock);
+    wait_queue_wake_one(&cv->wq);
+    spin_unlock(&cv->lock);
+    irq_restore(flags);
+}
+
+/* 唤醒所有等待条件变量的任务 */
+void cond_broadcast(struct condvar *cv){
+    reg_t flags = irq_save();
+    spin_lock(&cv->lock);
+    wait_queue_wake_all(&cv->wq);
+    spin_unlock(&cv->lock);
+    irq_restore(flags);
+}
@@ -5,20 +5,79 @@
 #include <stddef.h> 
 #include "../include/riscv.h"
 
+struct context;
+
 /* 该函数定义在 entry.S */
 extern void switch_to(struct context *next);
+extern void switch_to_fast(struct context *next);
 
-/* 定义优先级等级上限 */
-#define Priority_num 10
-/* 定义任务栈大小 */
-#define STACK_SIZE 4*1024
+/* 定义优先级等级上限，0为最高优先级，就绪位图为64位，故最多64级 */
+#define Priority_num 32
+#if Priority_num > 64
+#error "Priority_num must not exceed 64"
+#endif
+/*
+ * 任务栈
+ * STACK_SIZE：创建任务时栈大小为0时使用的默认大小
+ * STACK_MIN：栈大小的下限，中断处理函数同样运行在被打断任务的栈上
+ * STACK_GUARD：栈底之下的保护区大小（2的幂），
+ *   在QEMU上由PMP表项0覆盖，切换任务时还会检查其中的填充值是否被改写
+ * STACK_FILL：创建任务时栈与保护区的填充值，用于统计栈的最大使用量
+ */
+#define STACK_SIZE  (4*1024)
+#define STACK_MIN   1024
+#define STACK_GUARD 64
+#define STACK_FILL  0xa5a5a5a5a5a5a5a5ULL
+/*
+ * 用户模式的任务的内核栈区域的大小（2的幂），位于保护区之下并按其大小对齐，
+ * 在QEMU上与保护区一起由PMP表项0覆盖，用户模式不可访问
+ */
+#define KSTACK_SIZE 2048
+/* 任务的栈内存的大小：保护区、栈与栈顶之上的上下文 */
+#define STACK_MEM_SIZE(size) (STACK_GUARD + (size) + sizeof(struct context))
 
 /* task_num：保存当前系统中的任务总数 */
 extern int task_num;
 
-extern void exit();
 extern void schedule();
 
+/*
+ * 返回x中最低的被置位的位的序号（x不能为0）
+ * rv64ima没有ctz指令，使用de Bruijn序列实现O(1)查找：
+ * x & -x 只保留最低的1，乘以de Bruijn常数后高6位唯一对应该位的序号
+ * ref: https://www.chessprogramming.org/BitScan
+ */
+static inline int __ffs64(uint64_t x)
+{
+	static const uint8_t index64[64] = {
+		 0,  1, 48,  2, 57, 49, 28,  3,
+		61, 58, 50, 42, 38, 29, 17,  4,
+		62, 55, 59, 36, 53, 51, 43, 22,
+		45, 39, 33, 30, 24, 18, 12,  5,
+		63, 47, 56, 27, 60, 41, 37, 16,
+		54, 35, 52, 21, 44, 32, 23, 11,
+		46, 26, 40, 15, 34, 20, 31, 10,
+		25, 14, 19,  9, 13,  8,  7,  6
+	};
+	return index64[((x & -x) * 0x03f79d71b4cb0a89ULL) >> 58];
+}
+
+/*
+ * 返回x中最高的被置位的位的序号加1，x为0时返回0
+ * 没有clz指令，二分查找
+ */
+static inline int __fls64(uint64_t x)
+{
+	int n = 0;
+	if (x >> 32) { n += 32; x >>= 32; }
+	if (x >> 16) { n += 16; x >>= 16; }
+	if (x >> 8)  { n += 8;  x >>= 8; }
+	if (x >> 4)  { n += 4;  x >>= 4; }
+	if (x >> 2)  { n += 2;  x >>= 2; }
+	if (x >> 1)  { n += 1;  x >>= 1; }
+	return n + (int)x;
+}
+
 /* task management */
 struct context {
 	/* ignore x0 */
@@ -53,6 +112,344 @@ struct context {
 	reg_t t4;
 	reg_t t5;
 	reg_t t6;
+	/* 任务恢复时的执行地址，偏移248 */
+	reg_t pc;
+	/* 上下文类型，偏移256，见CTX_FULL/CTX_PARTIAL */
+	reg_t flag;
+	/*
+	 * 偏移264，为1表示上下文正在被某个hart使用（任务正在运行或尚未保存完毕），
+	 * 由调度器在选中任务时置1，由entry.S在上下文保存完毕后清0，
+	 * 为1时其它hart不能窃取该任务
+	 */
+	reg_t running;
+	/*
+	 * 偏移272，恢复上下文时mstatus.MPP的值：MSTATUS_MPP为机器模式，0为用户模式
+	 * 由trap入口按照被打断时的特权级保存，switch_to/switch_to_fast保存时总是机器模式
+	 */
+	reg_t mpp;
+	/*
+	 * 偏移280，用户模式的任务进入内核（trap或系统调用）时使用的内核栈的栈顶，
+	 * 机器模式的任务为0，见task_alloc()
+	 */
+	reg_t kstack;
+};
+
+/*
+ * 任务状态
+ * TASK_READY：位于就绪队列中（包括正在运行）
+ * TASK_BLOCKED：不在就绪队列中，等待被task_wakeup()唤醒
+ */
+#define TASK_READY   0
+#define TASK_BLOCKED 1
+
+/*
+ * 调度类，EDF > PRIO > FAIR，高的调度类总是优先于低的调度类
+ * SCHED_EDF：周期性实时任务，按照绝对截止时间最早优先（EDF）调度，见edf.c
+ * SCHED_PRIO：固定优先级，同优先级内轮转
+ * SCHED_FAIR：按权重分享CPU，虚拟运行时间最小的任务优先，见fair.c
+ *   只在没有就绪的EDF与固定优先级任务时运行
+ */
+#define SCHED_PRIO 0
+#define SCHED_EDF  1
+#define SCHED_FAIR 2
+
+/*
+ * EDF任务的参数与当前作业的状态，时间的单位均为mtime的计数周期
+ * period/rel_deadline/budget：周期、相对截止时间与每个周期的执行预算
+ * release：当前作业的释放时间
+ * next_release：等待下一个周期时记录的释放时间，由task_wakeup()在入队之前开始新的作业，
+ *   不为0表示尚未释放
+ * job_deadline：当前作业的绝对截止时间，作业完成时据此统计是否错过截止时间
+ * deadline：调度使用的绝对截止时间，预算耗尽时推迟一个周期并补充预算，
+ *   这样超出预算的任务不会挤占其它EDF任务的带宽（CBS）
+ * budget_left：当前作业剩余的预算，可能为负
+ * util：任务的利用率（密度），用于准入控制
+ * miss_count/overrun_count：错过截止时间与预算耗尽的次数
+ * heap_index：任务在EDF堆中的下标
+ */
+struct edf_param {
+	uint64_t period;
+	uint64_t rel_deadline;
+	uint64_t budget;
+	uint64_t release;
+	uint64_t next_release;
+	uint64_t job_deadline;
+	uint64_t deadline;
+	int64_t  budget_left;
+	uint64_t util;
+	uint64_t miss_count;
+	uint64_t overrun_count;
+	int heap_index;
+};
+
+/* 每个hart最多容纳的EDF任务数 */
+#define EDF_MAX_TASKS 64
+/* 利用率的单位：百万分之一 */
+#define EDF_UTIL_SCALE 1000000
+/* 每个hart上EDF任务的总利用率上限，为固定优先级任务保留10% */
+#define EDF_UTIL_MAX (EDF_UTIL_SCALE / 10 * 9)
+
+/* nice值的范围，nice越小权重越大，nice为0时权重为FAIR_WEIGHT_0 */
+#define FAIR_NICE_MIN (-20)
+#define FAIR_NICE_MAX 19
+#define FAIR_WEIGHT_0 1024
+/* 唤醒的任务最多获得的虚拟运行时间补偿，单位为mcycle周期 */
+#define FAIR_WAKEUP_CREDIT 1000000ULL
+
+/*
+ * SCHED_FAIR任务的参数
+ * vruntime：虚拟运行时间，实际运行的mcycle周期数乘以FAIR_WEIGHT_0/weight，
+ *   任务在就绪队列中时为绝对值，离开就绪队列时保存为相对于该hart的min_vruntime的值，
+ *   这样任务阻塞后被唤醒或被迁移到其它hart时，与新队列中的任务仍然可以比较
+ * weight：由nice值决定的权重
+ * left/right/heap_prio：在树堆中的子节点与堆优先级
+ */
+struct fair_param {
+	uint64_t vruntime;
+	uint32_t weight;
+	uint32_t heap_prio;
+	struct Task *left;
+	struct Task *right;
+};
+
+/*
+ * 每个hart的公平调度就绪队列
+ * min_vruntime：队列中最小vruntime的单调不减的下界，新加入的任务以它为基准
+ */
+struct fair_rq {
+	struct Task *root;
+	uint64_t min_vruntime;
+	int nr;
+	uint32_t seed;
+};
+
+/*
+ * 每个hart的EDF就绪队列：按照deadline排序的二叉最小堆，
+ * 插入、删除与修改截止时间均为O(log n)，堆顶即为截止时间最早的任务
+ * util：该hart上已经准入的EDF任务的总利用率，由准入控制维护
+ */
+struct edf_rq {
+	struct Task *heap[EDF_MAX_TASKS];
+	int nr;
+	uint64_t util;
+};
+
+/*
+ * 为1时统计每个任务的CPU时间，见task_top()，为0时统计代码被完全去掉
+ * 由common.mk中的SCHED_ACCT控制
+ */
+#ifndef SCHED_ACCT
+#define SCHED_ACCT 1
+#endif
+
+/*
+ * 为1时统计唤醒到运行的延迟直方图，见latency.c，为0时统计代码被完全去掉
+ * 由common.mk中的SCHED_LATENCY控制
+ */
+#ifndef SCHED_LATENCY
+#define SCHED_LATENCY 1
+#endif
+
+/* 延迟直方图的桶数，第i个桶统计[2^(i-1), 2^i)个mtime计数周期的延迟，桶0统计0 */
+#define LAT_BUCKETS 40
+
+#if SCHED_ACCT
+/*
+ * 每个任务的CPU时间统计
+ * cycles/instret：运行期间的mcycle与minstret增量
+ * run_time/ready_time：运行与在就绪队列中等待的时间，mtime计数周期
+ * nvcsw/nivcsw：主动让出CPU（让出、阻塞）与被抢占的次数
+ * create_time：任务创建的mtime
+ * ready_since：任务最近一次进入就绪状态（或被切换出去但仍就绪）的mtime
+ */
+struct task_acct {
+	uint64_t cycles;
+	uint64_t instret;
+	uint64_t run_time;
+	uint64_t ready_time;
+	uint64_t nvcsw;
+	uint64_t nivcsw;
+	uint64_t create_time;
+	uint64_t ready_since;
 };
+#endif
+
+/*
+ * 缓存行大小，任务控制块按它对齐
+ * TCB_CHUNK：任务控制块池用完时一次从堆中分配的任务控制块个数，任务数只受堆的大小限制
+ */
+#define CACHE_LINE    64
+#define TCB_CHUNK     16
+
+/*
+ * 定义每一个任务的结构体（任务控制块）
+ * 调度器选择任务、操作就绪队列时访问的字段集中在第一个缓存行，
+ * 其余字段按照使用场合排在后面；上下文与栈不在任务控制块中，
+ * 它们只在切换到该任务时才被访问，见stack_setup()
+ */
+struct Task
+{
+	/* 当前（可能被优先级继承提升的）优先级，就绪队列按照它排序 */
+	uint8_t priority;
+	/* 创建任务时指定的优先级 */
+	uint8_t base_priority;
+	/* 任务当前所在就绪队列所属的hart */
+	uint8_t hart;
+	uint8_t state;
+	/* 调度类，见SCHED_PRIO/SCHED_EDF */
+	uint8_t policy;
+	/* 为1表示任务位于就绪队列中 */
+	uint8_t on_rq;
+	/* tid：任务编号，从1开始递增 */
+	uint32_t tid;
+	struct Task *front;
+	struct Task *next;
+	/* 任务的上下文，位于栈顶之上 */
+	struct context *ctx;
+	/* 任务所属的任务组，见group.c，为NULL表示不受配额限制 */
+	struct task_group *group;
+#if SCHED_LATENCY
+	/* 任务被唤醒（或创建）后进入就绪队列的mtime，被调度运行后清0 */
+	uint64_t wake_time;
+#endif
+
+	/* SCHED_FAIR任务的参数 */
+	struct fair_param fair;
+	/* SCHED_EDF任务的参数 */
+	struct edf_param edf;
+
+	/*
+	 * 栈，见stack_setup()
+	 * stack_base：栈的最低地址，其下STACK_GUARD字节为保护区，栈顶为stack_base + stack_size
+	 * stack_mem：malloc()返回的栈内存，空闲任务的栈为静态分配，此处为NULL
+	 */
+	uint8_t *stack_base;
+	uint32_t stack_size;
+	void *stack_mem;
+
+	/*
+	 * 定时器轮，见sleep.c
+	 * expire_tick：到期的时间片计数，为0表示不在定时器轮中
+	 * timer_front/timer_next：挂在同一个槽中的任务组成的双向链表
+	 */
+	uint64_t expire_tick;
+	struct Task *timer_front;
+	struct Task *timer_next;
+
+	/*
+	 * 等待队列，见sync.c
+	 * wait_next：同一等待队列中的下一个任务
+	 * wait_on：任务所在的等待队列，为NULL表示不在等待队列中
+	 * wait_data：等待期间与唤醒者交换的数据，如消息队列传递的消息
+	 * held_mutex：任务持有的互斥锁组成的链表，用于计算继承的优先级
+	 */
+	struct Task *wait_next;
+	struct wait_queue *wait_on;
+	void *wait_data;
+	struct mutex *held_mutex;
+
+	/*
+	 * 任务通知，见notify.c
+	 * notify_value：通知值
+	 * notify_pending：有尚未被notify_wait()/notify_take()取走的通知
+	 * notify_waiting：任务正在等待通知
+	 * notify_lock：保护以上字段
+	 */
+	uint32_t notify_value;
+	uint8_t notify_pending;
+	uint8_t notify_waiting;
+	struct spinlock notify_lock;
+
+	/* 任务组被节流时，被移出就绪队列的任务组成的链表，见group.c */
+	struct Task *throttle_next;
+
+	/*
+	 * entry：任务例程进入点
+	 * list_front/list_next：所有任务组成的双向链表
+	 */
+	void (*entry)(void *param);
+	struct Task *list_front;
+	struct Task *list_next;
+#if SCHED_ACCT
+	struct task_acct acct;
+#endif
+} __attribute__((aligned(CACHE_LINE)));
+
+extern struct Task *task_self();
+extern void task_prepare_block();
+extern void task_block(struct spinlock *lk);
+extern void task_wakeup(struct Task *task);
+extern void task_set_priority(struct Task *task, uint8_t priority);
+
+/* 等待队列，见sync.c */
+extern void wait_queue_init(struct wait_queue *wq, uint8_t order);
+extern void wait_queue_sleep(struct wait_queue *wq, struct spinlock *lk);
+extern int  wait_queue_sleep_timeout(struct wait_queue *wq, struct spinlock *lk,
+                                     uint64_t timeout);
+extern struct Task *wait_queue_pop(struct wait_queue *wq);
+extern int  wait_queue_wake_one(struct wait_queue *wq);
+extern int  wait_queue_wake_all(struct wait_queue *wq);
+
+/* EDF就绪队列，见edf.c */
+extern void edf_rq_init(struct edf_rq *rq);
+extern void edf_rq_insert(struct edf_rq *rq, struct Task *task);
+extern void edf_rq_remove(struct edf_rq *rq, struct Task *task);
+extern struct Task *edf_rq_first(struct edf_rq *rq);
+
+/* 公平调度就绪队列，见fair.c */
+extern uint32_t fair_weight(int nice);
+extern void fair_rq_init(struct fair_rq *rq);
+extern void fair_rq_insert(struct fair_rq *rq, struct Task *task);
+extern void fair_rq_remove(struct fair_rq *rq, struct Task *task);
+extern struct Task *fair_rq_first(struct fair_rq *rq);
+extern struct Task *fair_rq_next(struct fair_rq *rq, struct Task *task);
+
+/*
+ * 任务组：组内所有任务在每个周期内合计最多运行quota的时间（mtime计数周期）
+ * 配额用完后组被节流，组内的任务在被选中时移出就绪队列，
+ * 挂入throttled链表，直到下一个周期补充配额时重新唤醒
+ * runtime_left：本周期剩余的配额，可能为负，超出的部分从下一个周期扣除
+ * next_refill：下一次补充配额的mtime
+ * throttled/throttle_start：是否被节流，以及本次节流开始的mtime
+ * nr_periods/nr_throttled/throttled_time：经历的周期数、被节流的周期数
+ *   与被节流的总时间，用于调整配额
+ */
+struct task_group {
+	struct spinlock lock;
+	uint64_t quota;
+	uint64_t period;
+	int64_t  runtime_left;
+	uint64_t next_refill;
+	int      throttled;
+	uint64_t throttle_start;
+	struct Task *throttled_tasks;
+	uint64_t nr_periods;
+	uint64_t nr_throttled;
+	uint64_t throttled_time;
+	struct task_group *next;
+};
+
+/* 任务组，见group.c */
+extern void task_group_charge(struct task_group *g, uint64_t delta);
+extern int  task_group_park(struct task_group *g, struct Task *task);
+
+/* 看门狗，见watchdog.c */
+extern uint64_t watchdog_limit;
+extern int watchdog_fire(struct Task *task, int hart, uint64_t held, reg_t epc, int irq_off);
+
+/* 唤醒延迟直方图，见latency.c */
+extern void lat_record(int hart, uint8_t priority, uint64_t delta);
+
+/* 定时器轮，见sleep.c */
+extern void timer_wheel_add(struct Task *task, uint64_t expire_tick);
+extern int  timer_wheel_del(struct Task *task);
+
+/*
+ * 上下文类型
+ * CTX_FULL：保存了全部通用寄存器（trap或switch_to）
+ * CTX_PARTIAL：仅保存了callee-saved寄存器（switch_to_fast）
+ */
+#define CTX_FULL    0
+#define CTX_PARTIAL 1
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "../include/os.h"
 
-#define DELAY 1000
+/* 每轮睡眠500ms */
+#define DELAY 500000
 
 void user_task0(void)
 {
@@ -10,7 +11,7 @@ void user_task0(void)
 		uart_puts("Task 0: Running...\n");
 		//trap_test();
 		i++;
-		task_delay(DELAY);
+		task_sleep_us(DELAY);
 		task_yield();
 	}
 	task_exit();
@@ -23,7 +24,7 @@ void user_task1(void)
 	while (i < 10) {
 		uart_puts("Task 1: Running...\n");
 		i++;
-		task_delay(DELAY);
+		task_sleep_us(DELAY);
 		task_yield();
 	}
 	task_exit();
@@ -37,7 +38,7 @@ void user_task2(void)
 		uart_puts("Task 2: Running...\n");
 		i++;
 		//uart_isr();
-		task_delay(DELAY);
+		task_sleep_us(DELAY);
 		task_yield();
 	}
 	task_exit();
@@ -46,7 +47,7 @@ void user_task2(void)
 /* NOTICE: DON'T LOOP INFINITELY IN main() */
 void os_main(void)
 {
-	task_create(user_task0,NULL,0);
-	task_create(user_task1,NULL,0);
-	task_create(user_task2,NULL,1);
+	task_create(user_task0,NULL,0,0);
+	task_create(user_task1,NULL,0,0);
+	task_create(user_task2,NULL,1,0);
 }
\ No newline at end of file
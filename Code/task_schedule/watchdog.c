@@ -0,0 +1,139 @@
+#include "task_schedule.h"
+
+/*
+ * 看门狗：记录连续占用CPU超时的任务
+ *
+ * 检查由调度器在定时器中断中进行（见cooperative.c的watchdog_tick()），
+ * 这里保存设置与最近的超时记录，便于在没有调试器的情况下找出长时间不让出CPU的任务。
+ * 超时记录组成环形缓冲区，由wd_lock保护，只在中断处理函数中写入。
+ * 中断处理函数中只做记录，不打印，记录由watchdog_stat()在任务上下文中打印
+ */
+
+/* 保存的超时记录数 */
+#define WD_LOG_SIZE 8
+
+/*
+ * 一次超时记录
+ * held：检测到超时时任务已经连续占用CPU的时间，mtime计数周期
+ * epc：定时器中断打断任务的位置，irq_off为1时无法采样，为0
+ * irq_off：由hart 0代为发现，该hart的定时器中断被屏蔽
+ */
+struct wd_record {
+	uint32_t tid;
+	uint8_t  hart;
+	uint8_t  action;
+	uint8_t  irq_off;
+	reg_t    entry;
+	reg_t    epc;
+	uint64_t held;
+	uint64_t time;
+};
+
+/* 超时上限（mtime计数周期），为0时看门狗关闭 */
+uint64_t watchdog_limit = 0;
+static int watchdog_action = WD_REPORT;
+
+static struct wd_record wd_log[WD_LOG_SIZE];
+static uint32_t wd_count = 0;
+static struct spinlock wd_lock;
+
+static const char *wd_action_name[] = {"report", "resched", "kill"};
+
+/*
+ * 描述：
+ * 设置看门狗，检查的精度为一个时间片
+ * - limit_us：任务连续占用CPU的上限，微秒，为0时关闭看门狗
+ * - action：超时时的处理方式
+ *   WD_REPORT：只记录
+ *   WD_RESCHED：记录，并让任务停止运行一个时间片
+ *   WD_KILL：记录，并终止任务（任务持有的互斥锁不会被释放）
+ */
+void watchdog_set(uint64_t limit_us, int action){
+    if(action < WD_REPORT || action > WD_KILL){
+        action = WD_REPORT;
+    }
+    reg_t flags = irq_save();
+    spin_lock(&wd_lock);
+    watchdog_action = action;
+    watchdog_limit = timer_us_to_cycles(limit_us);
+    spin_unlock(&wd_lock);
+    irq_restore(flags);
+}
+
+/*
+ * 由调度器在定时器中断中调用，记录一次超时
+ * 关中断时打印会让中断延迟随串口输出增长，这里只写入记录，由watchdog_stat()打印
+ * - task：超时的任务
+ * - hart：任务所在的hart
+ * - held：任务已经连续占用CPU的时间，mtime计数周期
+ * - epc：被打断处的地址
+ * - irq_off：为1表示由其它hart发现，该hart关闭了中断，无法进行处理
+ * 返回值：
+ * 调用者需要执行的处理方式，irq_off为1时总是WD_REPORT
+ */
+int watchdog_fire(struct Task *task, int hart, uint64_t held, reg_t epc, int irq_off){
+    spin_lock(&wd_lock);
+    int action = irq_off ? WD_REPORT : watchdog_action;
+    struct wd_record *r = &wd_log[wd_count % WD_LOG_SIZE];
+    r->tid = task->tid;
+    r->hart = hart;
+    r->action = action;
+    r->irq_off = irq_off;
+    r->entry = (reg_t)task->entry;
+    r->epc = epc;
+    r->held = held;
+    r->time = timer_get_mtime();
+    wd_count++;
+    spin_unlock(&wd_lock);
+    return action;
+}
+
+/*
+ * 描述：
+ * 打印看门狗的设置与最近WD_LOG_SIZE次超时记录（从旧到新）
+ * 只能在任务上下文中调用；每条记录在wd_lock下复制后再打印，
+ * 打印期间新增的超时覆盖了尚未打印的记录时，跳过被覆盖的记录
+ */
+void watchdog_stat(){
+    reg_t flags = irq_save();
+    spin_lock(&wd_lock);
+    uint32_t count = wd_count;
+    int action = watchdog_action;
+    uint64_t limit = watchdog_limit;
+    spin_unlock(&wd_lock);
+    irq_restore(flags);
+
+    uint32_t start = count > WD_LOG_SIZE ? count - WD_LOG_SIZE : 0;
+    printf("watchdog: limit %ld us, action %s, %d timeouts\n",
+           timer_cycles_to_us(limit), wd_action_name[action], count);
+    if(count == 0){
+        return;
+    }
+    printf("  tid hart            entry             mepc      held(us)      time(us)  action\n");
+    for(uint32_t i = start;i < count;i++){
+        struct wd_record r;
+        flags = irq_save();
+        spin_lock(&wd_lock);
+        int valid = wd_count - i <= WD_LOG_SIZE;
+        if(valid){
+            struct wd_record *src = &wd_log[i % WD_LOG_SIZE];
+            r.tid = src->tid;
+            r.hart = src->hart;
+            r.action = src->action;
+            r.irq_off = src->irq_off;
+            r.entry = src->entry;
+            r.epc = src->epc;
+            r.held = src->held;
+            r.time = src->time;
+        }
+        spin_unlock(&wd_lock);
+        irq_restore(flags);
+        if(!valid){
+            continue;
+        }
+        printf("%5d %4d %16lx %16lx %13ld %13ld  %s%s\n",
+               r.tid, r.hart, r.entry, r.epc,
+               timer_cycles_to_us(r.held), timer_cycles_to_us(r.time),
+               wd_action_name[r.action], r.irq_off ? " (irq off)" : "");
+    }
+}
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""
+将RVOS的内核跟踪缓冲区（见include/trace.h）转换为Chrome/Perfetto可以打开的trace JSON
+
+两种输入：
+  1. UART输出：内核调用trace_dump()后，把串口日志保存为文本文件
+       python3 trace2perfetto.py --uart uart.log -o trace.json
+  2. 内存转储：在QEMU monitor中执行 pmemsave 0x80000000 0x8000000 mem.bin，
+     或在gdb中 dump binary memory mem.bin 0x80000000 0x88000000，
+     工具按照缓冲区头部的魔数搜索各hart的缓冲区
+       python3 trace2perfetto.py --dump mem.bin -o trace.json
+
+输出在 https://ui.perfetto.dev 或 chrome://tracing 中打开：
+每个hart有一条"tasks"轨道显示正在运行的任务，一条"traps"轨道显示trap与外部中断，
+malloc/free/page_alloc/page_free显示为瞬时事件
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+TRACE_MAGIC = 0x52545652
+HEADER = struct.Struct("<IIIIQQ")
+RECORD = struct.Struct("<QIIQ")
+
+TRACE_SWITCH = 1
+TRACE_TRAP_ENTER = 2
+TRACE_TRAP_EXIT = 3
+TRACE_IRQ_CLAIM = 4
+TRACE_IRQ_COMPLETE = 5
+TRACE_MALLOC = 6
+TRACE_FREE = 7
+TRACE_PAGE_ALLOC = 8
+TRACE_PAGE_FREE = 9
+
+INTERRUPT_NAMES = {3: "software irq", 7: "timer irq", 11: "external irq"}
+
+
+def parse_uart(path):
+    """解析trace_dump()的输出，返回 {hart: (timebase, [records])}"""
+    harts = {}
+    current = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            words = line.split()
+            if len(words) >= 4 and words[0] == "TRACE" and words[1] == "BEGIN":
+                current = int(words[2])
+                harts[current] = (int(words[3]), [])
+            elif len(words) >= 3 and words[0] == "TRACE" and words[1] == "END":
+                current = None
+            elif current is not None and len(words) == 4:
+                try:
+                    rec = tuple(int(w, 16) for w in words)
+                except ValueError:
+                    continue
+                harts[current][1].append(rec)
+    return harts
+
+
+def parse_dump(path):
+    """在内存转储中搜索各hart的缓冲区，返回 {hart: (timebase, [records])}"""
+    with open(path, "rb") as f:
+        data = f.read()
+    harts = {}
+    magic = struct.pack("<I", TRACE_MAGIC)
+    pos = data.find(magic)
+    while pos != -1:
+        if pos % 8 == 0 and pos + HEADER.size <= len(data):
+            _, hart, size, rec_size, timebase, head = HEADER.unpack_from(data, pos)
+            end = pos + HEADER.size + size * rec_size
+            valid = (rec_size == RECORD.size and size > 0 and size & (size - 1) == 0
+                     and timebase > 0 and end <= len(data) and hart not in harts)
+            if valid:
+                records = []
+                for i in range(max(0, head - size), head):
+                    off = pos + HEADER.size + (i % size) * rec_size
+                    records.append(RECORD.unpack_from(data, off))
+                harts[hart] = (timebase, records)
+                pos = end - 1
+        pos = data.find(magic, pos + 1)
+    return harts
+
+
+def trap_name(cause):
+    code = cause & 0xfff
+    if cause & 0x80000000:
+        return INTERRUPT_NAMES.get(code, "irq %d" % code)
+    return "exception %d" % code
+
+
+def convert(harts):
+    events = []
+    for hart in sorted(harts):
+        timebase, records = harts[hart]
+        task_tid = hart * 2
+        trap_tid = hart * 2 + 1
+        events.append({"ph": "M", "pid": 0, "tid": task_tid, "name": "thread_name",
+                       "args": {"name": "hart %d tasks" % hart}})
+        events.append({"ph": "M", "pid": 0, "tid": trap_tid, "name": "thread_name",
+                       "args": {"name": "hart %d traps" % hart}})
+
+        running = None      # (task tid, 开始时间)
+        trap_depth = 0
+        last_us = 0.0
+        for ts, event, arg0, arg1 in records:
+            us = ts * 1e6 / timebase
+            last_us = us
+            if event == TRACE_SWITCH:
+                if running is not None:
+                    events.append({"ph": "X", "pid": 0, "tid": task_tid,
+                                   "name": task_label(running[0]), "ts": running[1],
+                                   "dur": us - running[1]})
+                running = (arg1, us)
+            elif event == TRACE_TRAP_ENTER:
+                trap_depth += 1
+                events.append({"ph": "B", "pid": 0, "tid": trap_tid, "ts": us,
+                               "name": trap_name(arg0), "args": {"mepc": hex(arg1)}})
+            elif event == TRACE_TRAP_EXIT:
+                # 缓冲区回绕后第一条记录可能是没有配对的退出记录
+                if trap_depth > 0:
+                    trap_depth -= 1
+                    events.append({"ph": "E", "pid": 0, "tid": trap_tid, "ts": us})
+            elif event == TRACE_IRQ_CLAIM:
+                events.append({"ph": "B", "pid": 0, "tid": trap_tid, "ts": us,
+                               "name": "plic irq %d" % arg0})
+                trap_depth += 1
+            elif event == TRACE_IRQ_COMPLETE:
+                if trap_depth > 0:
+                    trap_depth -= 1
+                    events.append({"ph": "E", "pid": 0, "tid": trap_tid, "ts": us})
+            elif event in (TRACE_MALLOC, TRACE_FREE, TRACE_PAGE_ALLOC, TRACE_PAGE_FREE):
+                name = {TRACE_MALLOC: "malloc", TRACE_FREE: "free",
+                        TRACE_PAGE_ALLOC: "page_alloc", TRACE_PAGE_FREE: "page_free"}[event]
+                args = {"addr": hex(arg1)}
+                if event == TRACE_MALLOC:
+                    args["size"] = arg0
+                elif event == TRACE_PAGE_ALLOC:
+                    args["npages"] = arg0
+                events.append({"ph": "i", "s": "t", "pid": 0, "tid": task_tid, "ts": us,
+                               "name": name, "args": args})
+        if running is not None:
+            events.append({"ph": "X", "pid": 0, "tid": task_tid, "name": task_label(running[0]),
+                           "ts": running[1], "dur": last_us - running[1]})
+        for _ in range(trap_depth):
+            events.append({"ph": "E", "pid": 0, "tid": trap_tid, "ts": last_us})
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def task_label(tid):
+    return "idle" if tid == 0 else "task %d" % tid
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--uart", help="包含trace_dump()输出的串口日志")
+    source.add_argument("--dump", help="QEMU/gdb导出的物理内存转储")
+    parser.add_argument("-o", "--output", default="-", help="输出的JSON文件，默认为标准输出")
+    args = parser.parse_args()
+
+    harts = parse_uart(args.uart) if args.uart else parse_dump(args.dump)
+    if not harts:
+        sys.exit("no trace buffer found")
+    trace = convert(harts)
+    if args.output == "-":
+        json.dump(trace, sys.stdout)
+    else:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+
+
+if __name__ == "__main__":
+    main()